@@ -0,0 +1,78 @@
+/**
+ * \brief	Frame codec microbenchmark
+ * \author	Circuit Chaos
+ * \date	2020-04-04
+ *
+ * Times encoding of write frames and checksum validation with sizes
+ * known at compile time (CFrame<N>) against the runtime-sized fallback
+ * (CFrame<0>). Not part of omi; built with scons bench.
+ */
+
+#include <cstdio>
+#include <chrono>
+#include <array>
+#include "frame.h"
+
+static const unsigned ITERATIONS	= 1000000;
+
+// keeps the compiler from optimizing the measured loops away
+static volatile unsigned s_sink;
+
+// returns nanoseconds per frame
+template<size_t N> static double encode(const CFrame<N> &frame, uint8_t *buf, const uint8_t *data)
+{
+	const auto start(std::chrono::steady_clock::now());
+	unsigned sum(0);
+	for (unsigned i(0); i < ITERATIONS; ++i)
+		sum += frame.encodeWrite(buf, i, data) + buf[CFrame<N>::DATA_OFFSET + frame.getSize()];
+
+	const auto elapsed(std::chrono::steady_clock::now() - start);
+	s_sink = sum;
+	return std::chrono::duration<double, std::nano>(elapsed).count() / ITERATIONS;
+}
+
+template<size_t N> static double validate(const CFrame<N> &frame, uint8_t *buf)
+{
+	const auto start(std::chrono::steady_clock::now());
+	unsigned sum(0);
+	for (unsigned i(0); i < ITERATIONS; ++i)
+	{
+		// changes the frame, so checksum can't be computed only once
+		buf[CFrame<N>::DATA_OFFSET] = i;
+		sum += frame.checksumValid(buf);
+	}
+
+	const auto elapsed(std::chrono::steady_clock::now() - start);
+	s_sink = sum;
+	return std::chrono::duration<double, std::nano>(elapsed).count() / ITERATIONS;
+}
+
+template<size_t N> static void run()
+{
+	std::array<uint8_t, N> data;
+	for (size_t i(0); i < N; ++i)
+		data[i] = i * 7;
+
+	std::array<uint8_t, N + CFrame<N>::OVERHEAD> buf;
+	const CFrame<N> fixed;
+	const CFrame<0> dynamic(N);
+
+	const double fixedEncode(encode(fixed, &buf[0], &data[0]));
+	const double fixedValidate(validate(fixed, &buf[0]));
+	const double dynamicEncode(encode(dynamic, &buf[0], &data[0]));
+	const double dynamicValidate(validate(dynamic, &buf[0]));
+
+	printf("%5zu %12.1f %12.1f %12.1f %12.1f\n", N, fixedEncode, dynamicEncode, fixedValidate, dynamicValidate);
+}
+
+int main()
+{
+	printf("Nanoseconds per frame, %u iterations\n", ITERATIONS);
+	printf("%5s %12s %12s %12s %12s\n", "size", "encode<N>", "encode<0>", "check<N>", "check<0>");
+
+	run<0x10>();
+	run<0x20>();
+	run<0x40>();
+	run<0x80>();
+	return 0;
+}
@@ -14,7 +14,9 @@
 #include "omifile.h"
 #include "textfile.h"
 #include "impexp.h"
+#include "models.h"
 #include "util.h"
+#include "throw.h"
 
 using namespace impexp;
 
@@ -34,29 +36,121 @@ bool applet::CExport::run(int argc, char * const argv[])
 		return false;
 	}
 
-	if (infile.getData().size() != config::MEMORY_SIZE)
+	const models::SModel &caps(models::find(infile.getModel()));
+	if (infile.getData().size() != caps.memorySize)
 	{
 		loge(".omi file does not contain radio memory (size mismatch)");
 		return false;
 	}
 
-	CTextFile tf;
-
-	tf.add(2, strings::WELCOME, util::toPrintable(std::string((const char *) &infile.getData()[WELCOME_OFFSET], WELCOME_SIZE)).c_str());
-	tf.add(0);
-	outputKeysComment(tf);
-	outputKeys(tf, infile.getData());
-	tf.add(0);
-	outputSettingsComment(tf);
-	outputSettings(tf, infile.getData());
-	tf.add(0);
-	outputChannelComment(tf);
-	outputChannels(tf, infile.getData());
+	const region::TList regions(infile.getRegions());
+	if (!hasConfig(regions))
+	{
+		loge(".omi file contains only %s, needs channels and settings (omi read -s config)", region::toString(regions).c_str());
+		return false;
+	}
 
-	if (!tf.write(cli.getOutput(), cli.isText()))
+	CStream stream(infile.getData(), caps.numChannels, cli.getOutput(), cli.isText(), false);
+	if (!stream.isOpen())
 		return false;
 
-	return true;
+	for (const auto &r: regions)
+		stream.received(r.offset, r.size);
+
+	return stream.close();
+}
+
+applet::CExport::CStream::CStream(const std::vector<uint8_t> &data, unsigned numChannels, const std::string &path, bool isText, bool inPlace):
+	m_data(data),
+	m_numChannels(numChannels),
+	m_isText(isText),
+	m_inPlace(inPlace),
+	m_writer(path, inPlace),
+	m_ok(true),
+	m_headDone(false),
+	m_nextChannel(0)
+{
+	xassert(m_data.size() >= SETTINGS_END, "Memory image too small");
+}
+
+bool applet::CExport::CStream::isOpen() const
+{
+	return m_writer.isOpen();
+}
+
+region::TList applet::CExport::CStream::getFirst()
+{
+	return region::TList
+	{
+		region::SRegion { CHAN_EN_OFFSET, CHANNELS_END - CHAN_EN_OFFSET },
+		region::SRegion { SETTINGS_OFFSET, SETTINGS_END - SETTINGS_OFFSET },
+	};
+}
+
+void applet::CExport::CStream::received(uint16_t offset, uint16_t size)
+{
+	m_present.push_back(region::SRegion { offset, size });
+	region::normalize(m_present);
+
+	const unsigned flagsSize((m_numChannels + 7) / 8);
+	if (!m_headDone)
+	{
+		if (!region::contains(m_present, WELCOME_OFFSET, WELCOME_SIZE) ||
+			!region::contains(m_present, SETTINGS_OFFSET, SETTINGS_END - SETTINGS_OFFSET) ||
+			!region::contains(m_present, CHAN_EN_OFFSET, flagsSize) ||
+			!region::contains(m_present, SCANNING_OFFSET, flagsSize))
+			return;
+
+		CTextFile tf;
+		tf.add(2, strings::WELCOME, util::toPrintable(std::string((const char *) &m_data[WELCOME_OFFSET], WELCOME_SIZE)).c_str());
+		tf.add(0);
+		outputKeysComment(tf);
+		outputKeys(tf, m_data);
+		tf.add(0);
+		outputSettingsComment(tf);
+		outputSettings(tf, m_data);
+		tf.add(0);
+		outputChannelComment(tf);
+		output(tf);
+		m_headDone = true;
+	}
+
+	for (; m_nextChannel < m_numChannels && region::contains(m_present, m_nextChannel * sizeof(SChannel), sizeof(SChannel)); ++m_nextChannel)
+	{
+		CTextFile tf;
+		outputChannel(tf, m_data, m_nextChannel);
+		output(tf);
+	}
+}
+
+bool applet::CExport::CStream::isComplete() const
+{
+	return m_headDone && m_nextChannel == m_numChannels;
+}
+
+bool applet::CExport::CStream::close()
+{
+	xassert(isComplete(), "Export not complete");
+	return m_ok && m_writer.close();
+}
+
+void applet::CExport::CStream::output(const CTextFile &tf)
+{
+	if (!m_ok)
+		return;
+
+	for (const auto &line: tf.get())
+	{
+		const std::string s(CTextFile::format(line, m_isText) + '\n');
+		if (!m_writer(s.c_str(), s.size()))
+			m_ok = false;
+	}
+
+	if (m_ok && m_inPlace && !m_writer.flush())
+		m_ok = false;
+
+	if (!m_ok)
+		loge("Write error, export will be incomplete");
 }
 
 void applet::CExport::outputChannelComment(CTextFile &tf)
@@ -104,42 +198,39 @@ void applet::CExport::outputKeysComment(CTextFile &tf)
 		NULL);
 }
 
-void applet::CExport::outputChannels(CTextFile &tf, const std::vector<uint8_t> &data)
+void applet::CExport::outputChannel(CTextFile &tf, const std::vector<uint8_t> &data, unsigned i)
 {
-	for (unsigned i(0); i < NUM_CHANNELS; ++i)
-	{
-		const unsigned chanNo(i + 1);
-		logd("Decoding channel %u", chanNo);
+	const unsigned chanNo(i + 1);
+	logd("Decoding channel %u", chanNo);
 
-		const SChannel *chan((const SChannel *) &data[i * 32]);
-		debugDumpChannel(chan);
+	const SChannel *chan((const SChannel *) &data[i * 32]);
+	debugDumpChannel(chan);
 
-		if (!getFlag(&data[CHAN_EN_OFFSET], i))
-		{
-			logd("Channel %u is empty", chanNo);
-			tf.add(2, "channel", util::format("%u", chanNo).c_str());
-			continue;
-		}
-
-		std::vector<std::string> v;
-
-		// xxx fix this chanNo mess with instance-wide state (like in appletimport)
-		v.push_back(strings::CHANNEL);
-		v.push_back(util::format("%u", chanNo));
-		v.push_back(util::stripRight(util::toPrintable(std::string((const char *) chan->chname, 5))));
-		v.push_back(getCombinedFreq(chanNo, chan->rxfreq, chan->txshift, chan->flags1.shiftdir));
-		v.push_back(getEncDec(chanNo, chan->flags3.rxdcs, chan->flags3.rxcts, chan->rxcts, chan->rxdcs, chan->rxdcsfl));
-		v.push_back(getEncDec(chanNo, chan->flags3.txdcs, chan->flags3.txcts, chan->txcts, chan->txdcs, chan->txdcsfl));
-		v.push_back(getSquelchMode(chanNo, chan->sql));
-		v.push_back(getTxPower(chanNo, chan->flags2.txoff, chan->flags1.txpwr));
-		v.push_back(getBandwidth(chanNo, chan->flags2.bandwidth));
-		v.push_back(getBcl(chanNo, chan->bcl));
-		v.push_back(getPttId(chanNo, chan->pttid));
-		v.push_back(getOptSig(chanNo, chan->optsig, chan->flags3.dtmf));
-		v.push_back(getDefCts(chanNo, chan->defcts));
-		v.push_back(getFlags(getFlag(&data[SCANNING_OFFSET], i), chan->flags1.talkaround, chan->flags2.reverse));
-		tf.add(v);
+	if (!getFlag(&data[CHAN_EN_OFFSET], i))
+	{
+		logd("Channel %u is empty", chanNo);
+		tf.add(2, "channel", util::format("%u", chanNo).c_str());
+		return;
 	}
+
+	std::vector<std::string> v;
+
+	// xxx fix this chanNo mess with instance-wide state (like in appletimport)
+	v.push_back(strings::CHANNEL);
+	v.push_back(util::format("%u", chanNo));
+	v.push_back(util::stripRight(util::toPrintable(std::string((const char *) chan->chname, 5))));
+	v.push_back(getCombinedFreq(chanNo, chan->rxfreq, chan->txshift, chan->flags1.shiftdir));
+	v.push_back(getEncDec(chanNo, chan->flags3.rxdcs, chan->flags3.rxcts, chan->rxcts, chan->rxdcs, chan->rxdcsfl));
+	v.push_back(getEncDec(chanNo, chan->flags3.txdcs, chan->flags3.txcts, chan->txcts, chan->txdcs, chan->txdcsfl));
+	v.push_back(getSquelchMode(chanNo, chan->sql));
+	v.push_back(getTxPower(chanNo, chan->flags2.txoff, chan->flags1.txpwr));
+	v.push_back(getBandwidth(chanNo, chan->flags2.bandwidth));
+	v.push_back(getBcl(chanNo, chan->bcl));
+	v.push_back(getPttId(chanNo, chan->pttid));
+	v.push_back(getOptSig(chanNo, chan->optsig, chan->flags3.dtmf));
+	v.push_back(getDefCts(chanNo, chan->defcts));
+	v.push_back(getFlags(getFlag(&data[SCANNING_OFFSET], i), chan->flags1.talkaround, chan->flags2.reverse));
+	tf.add(v);
 }
 
 void applet::CExport::outputKeys(CTextFile &tf, const std::vector<uint8_t> &data)
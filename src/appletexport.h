@@ -10,7 +10,9 @@
 #include <string>
 #include "appletbase.h"
 #include "textfile.h"
+#include "rawfile.h"
 #include "impexp.h"
+#include "region.h"
 
 namespace applet
 {
@@ -20,11 +22,50 @@ namespace applet
 		virtual ~CExport() {}
 		virtual bool run(int argc, char * const argv[]);
 
+		// export fed with memory as it arrives (used also by omi read
+		// -t and -c); welcome message, keys and settings are written
+		// as soon as they are present, and then every channel, in
+		// order, as soon as its data is
+		class CStream
+		{
+		public:
+			// data must be the whole memory image, and stay valid;
+			// with inPlace, file is written directly (see CRawWriter)
+			// and flushed after every channel
+			CStream(const std::vector<uint8_t> &data, unsigned numChannels, const std::string &path, bool isText, bool inPlace);
+
+			bool isOpen() const;
+
+			// regions to read before others, so channels can be
+			// written while channel table is being read
+			static region::TList getFirst();
+
+			// called after data at offset has arrived
+			void received(uint16_t offset, uint16_t size);
+			bool isComplete() const;
+
+			// returns false if there was a write error
+			bool close();
+
+		private:
+			const std::vector<uint8_t> &m_data;
+			const unsigned m_numChannels;
+			const bool m_isText;
+			const bool m_inPlace;
+			CRawWriter m_writer;
+			bool m_ok;
+			region::TList m_present;
+			bool m_headDone;
+			unsigned m_nextChannel;
+
+			void output(const CTextFile &tf);
+		};
+
 	private:
 		static void outputChannelComment(CTextFile &tf);
 		static void outputKeysComment(CTextFile &tf);
 		static void outputSettingsComment(CTextFile &tf);
-		static void outputChannels(CTextFile &tf, const std::vector<uint8_t> &data);
+		static void outputChannel(CTextFile &tf, const std::vector<uint8_t> &data, unsigned i);
 		static void outputKeys(CTextFile &tf, const std::vector<uint8_t> &data);
 		static void outputSettings(CTextFile &tf, const std::vector<uint8_t> &data);
 		static void debugDumpChannel(const impexp::SChannel *chan);
@@ -16,12 +16,13 @@
 #include "omifile.h"
 #include "textfile.h"
 #include "impexp.h"
+#include "models.h"
 #include "throw.h"
 #include "util.h"
 
 using namespace impexp;
 
-applet::CImport::CImport(): m_chan(NULL)
+applet::CImport::CImport(): m_chan(NULL), m_numChannels(0)
 {
 }
 
@@ -41,16 +42,29 @@ bool applet::CImport::run(int argc, char * const argv[])
 		return false;
 	}
 
-	if (omi.getData().size() != config::MEMORY_SIZE)
+	const models::SModel &caps(models::find(omi.getModel()));
+	if (omi.getData().size() != caps.memorySize)
 	{
 		logError("input file does not contain radio memory (size mismatch)");
 		return false;
 	}
 
+	const region::TList regions(omi.getRegions());
+	if (!hasConfig(regions))
+	{
+		logError("input file contains only %s, needs channels and settings (omi read -s config)", region::toString(regions).c_str());
+		return false;
+	}
+
+	m_numChannels = caps.numChannels;
+
 	CTextFile tf;
 	if (!tf.read(cli.getInputTextCsv(), cli.inputIsText()))
 		return false;
 
+	// changed blocks are marked dirty, so omi write can upload only them
+	const std::vector<uint8_t> orig(omi.getData());
+
 	for (auto &line: tf.get())
 	{
 		++m_errCtx.lineNo;
@@ -85,7 +99,9 @@ bool applet::CImport::run(int argc, char * const argv[])
 		}
 	}
 
-	logd("Processed file, writing output");
+	omi.markChanged(orig);
+	logd("Processed file, %u bytes marked as changed, writing output", region::totalSize(omi.getDirty()));
+
 	if (!omi.write(cli.getOutputOmi()))
 		return false;
 
@@ -139,9 +155,9 @@ bool applet::CImport::importChannel(COmiFile &omi, const std::vector<std::string
 	}
 
 	const unsigned chanNo(strtol(line[1].c_str(), NULL, 10));
-	if (chanNo < 1 || chanNo > NUM_CHANNELS)
+	if (chanNo < 1 || chanNo > m_numChannels)
 	{
-		logError("channel number %s non-numeric or out of range (1-%u)", line[1].c_str(), NUM_CHANNELS);
+		logError("channel number %s non-numeric or out of range (1-%u)", line[1].c_str(), m_numChannels);
 		return false;
 	}
 
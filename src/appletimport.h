@@ -35,6 +35,9 @@ namespace applet
 		// used by all import functions except importWelcome and importChannel
 		impexp::SChannel *m_chan;
 
+		// taken from model capabilities of input file
+		unsigned m_numChannels;
+
 		// ouch, gcc bug? __attribute__((format(printf, 1, 2))) complains about non-string
 		// argument ("format string argument is not a string type"). maybe it counts
 		// "this" as a first argument?
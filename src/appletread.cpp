@@ -4,65 +4,198 @@
  * \date	2020-03-12
  */
 
+#include <algorithm>
+#include <memory>
 #include "appletread.h"
 #include "cliread.h"
 #include "config.h"
 #include "log.h"
-#include "port.h"
-#include "protocol.h"
+#include "session.h"
 #include "omifile.h"
+#include "journal.h"
+#include "appletexport.h"
+#include "impexp.h"
 #include "util.h"
 
+// writes regions read first to a separate file, so they can be used
+// while the rest is being read
+static void writeEarly(const COmiFile &of, const region::TList &priority, const std::string &path)
+{
+	if (priority.empty())
+	{
+		logn("None of the regions to read first is being read, not writing %s", path.c_str());
+		return;
+	}
+
+	COmiFile early(of);
+	early.setRegions(priority);
+
+	logn("Regions %s read, writing them to %s", region::toString(priority).c_str(), path.c_str());
+	if (!early.write(path))
+		loge("Cannot write %s, continuing", path.c_str());
+}
+
 bool applet::CRead::run(int argc, char * const argv[])
 {
 	cli::CRead cli;
 	if (!cli.parse(argc, argv))
 		return false;
 
-	CPort port(cli.getPort(), config::PORT_TIMEOUT);
-	if (!port.isOpen())
-	{
-		loge("Error opening communication port");
+	CSession session(cli.getPort(), cli.getWindow(), cli.getLowLatency());
+	if (!session.isOpen())
 		return false;
-	}
 
-	std::string model;
-	if (!protocol::handshake(port, model))
+	const models::SModel &caps(session.getCaps());
+	region::TList regions(caps.readable);
+	if (!cli.getRegions().empty() && !models::selectRegions(caps, cli.getRegions(), regions))
+		return false;
+
+	region::TList priority(caps.priority);
+	if (!cli.getPriority().empty() && !models::selectRegions(caps, cli.getPriority(), priority))
+		return false;
+
+	priority = region::intersect(priority, regions);
+
+	const bool exporting(!cli.getExportFile().empty());
+	if (exporting && !impexp::hasConfig(regions))
 	{
-		loge("Protocol error during handshake");
+		loge("Export needs channels and settings, but only %s is read", region::toString(regions).c_str());
 		return false;
 	}
 
-	logn("Radio ID string: %s", util::toPrintable(model).c_str());
+	logi("Reading regions %s", region::toString(regions).c_str());
+	logd("Regions read first: %s", region::toString(priority).c_str());
 
 	COmiFile of;
 	of.setOffset(0);
-	of.setModel(model);
-
-	const uint16_t size(config::MEMORY_SIZE);
+	of.setModel(session.getModel());
+	of.setRegions(regions);
 
 	std::vector<uint8_t> &data(of.getData());
-	data.resize(size);
-	for (uint16_t ofs(0); ofs < size; ofs += config::PACKET_SIZE)
+	data.assign(caps.memorySize, 0xff);
+
+	// export file grows while reading
+	std::unique_ptr<applet::CExport::CStream> stream;
+	if (exporting)
 	{
-		logi("Reading offset 0x%04x of 0x%04x (%u%%)", ofs, size, ofs * 100 / size);
-		if (!protocol::read(port, &data[ofs], ofs, config::PACKET_SIZE))
-		{
-			loge("Protocol error during read (offset 0x%04x)", ofs);
-			if (!protocol::end(port))
-				loge("Additional error while trying to terminate session");
+		stream.reset(new applet::CExport::CStream(data, caps.numChannels, cli.getExportFile(), cli.isExportText(), true));
+		if (!stream->isOpen())
+			return false;
+	}
+
+	// packets received by previous, interrupted read of the same radio
+	// are taken from journal; radio ID is the same for all radios of a
+	// model, so journal key also holds hash of radio-specific data, read
+	// first (and kept, if it's selected)
+	std::vector<uint8_t> fingerprint;
+	for (const auto &r: caps.fingerprint)
+	{
+		if (!session.read(&data[r.offset], r.offset, r.size))
 			return false;
+
+		fingerprint.insert(fingerprint.end(), data.begin() + r.offset, data.begin() + r.offset + r.size);
+	}
+
+	const std::string key(session.getModel() + util::format("\t%016llx", (unsigned long long) util::hash(fingerprint.data(), fingerprint.size())));
+	CJournal journal((cli.getFile().empty() ? cli.getExportFile() : cli.getFile()) + ".journal");
+	region::TList missing(regions);
+	if (journal.load(key))
+	{
+		region::TList present;
+		for (const auto &rec: journal.getRecords())
+		{
+			if (rec.data.size() != rec.size || rec.offset + rec.size > data.size())
+				continue;
+
+			std::copy(rec.data.begin(), rec.data.end(), data.begin() + rec.offset);
+			present.push_back(region::SRegion { rec.offset, rec.size });
 		}
+
+		region::normalize(present);
+		missing = region::subtract(regions, present);
+		if (stream)
+		{
+			for (const auto &r: region::intersect(regions, present))
+				stream->received(r.offset, r.size);
+		}
+
+		logn("Resuming interrupted read, %u of %u bytes taken from %s", region::totalSize(regions) - region::totalSize(missing),
+			region::totalSize(regions), journal.getPath().c_str());
 	}
 
-	if (!protocol::end(port))
+	if (!journal.open(key))
+		logn("Read will not be resumable if interrupted");
+
+	// fingerprint is not journaled, as it's read again on resume anyway
+	const region::TList known(region::intersect(missing, caps.fingerprint));
+	missing = region::subtract(missing, caps.fingerprint);
+	if (stream)
 	{
-		loge("Protocol error during termination");
-		return false;
+		for (const auto &r: known)
+			stream->received(r.offset, r.size);
 	}
 
-	if (!of.write(cli.getFile()))
+	session.setCommit([&journal, &data, &stream](uint16_t ofs, uint16_t size, bool)
+	{
+		journal.append(ofs, size, &data[ofs]);
+		if (stream)
+			stream->received(ofs, size);
+	});
+
+	// progress is shown as part of selected regions, not of memory
+	const unsigned total(region::totalSize(regions));
+	unsigned done(total - region::totalSize(missing));
+	uint16_t base(0);
+	session.setProgress([total, &done, &base](uint16_t ofs, bool)
+	{
+		logi("Reading offset 0x%04x (%u%%)", ofs, (done + ofs - base) * 100 / total);
+	});
+
+	region::TList pending(missing);
+	auto readRegions([&](const region::TList &list)
+	{
+		const region::TList now(region::intersect(pending, list));
+		pending = region::subtract(pending, list);
+
+		for (const auto &r: now)
+		{
+			base = r.offset;
+			if (!session.read(&data[r.offset], r.offset, r.size))
+			{
+				loge("Data read so far is kept in %s; repeat the command to resume", journal.getPath().c_str());
+				return false;
+			}
+
+			done += r.size;
+		}
+
+		return true;
+	});
+
+	// channel flags and settings are read before anything else when
+	// exporting, so channels can be written as they arrive, then
+	// priority regions, then the rest in address order
+	if (stream && !readRegions(applet::CExport::CStream::getFirst()))
+		return false;
+
+	if (!readRegions(priority))
+		return false;
+
+	if (!cli.getEarlyFile().empty())
+		writeEarly(of, priority, cli.getEarlyFile());
+
+	if (!readRegions(region::TList(pending)))
+		return false;
+
+	if (!session.close())
+		return false;
+
+	if (!cli.getFile().empty() && !of.write(cli.getFile()))
+		return false;
+
+	if (stream && !stream->close())
 		return false;
 
+	journal.remove();
 	return true;
 }
@@ -5,17 +5,167 @@
  */
 
 #include <memory>
+#include <functional>
+#include <algorithm>
 #include <cstring>
+#include <unistd.h>
 #include "appletwrite.h"
 #include "cliwrite.h"
 #include "config.h"
 #include "log.h"
-#include "port.h"
 #include "throw.h"
-#include "protocol.h"
+#include "session.h"
 #include "omifile.h"
+#include "journal.h"
+#include "textfile.h"
 #include "util.h"
 
+// reads current contents of blocks about to be written
+static bool readPreImage(CSession &session, const COmiFile &of, const region::TList &runs, COmiFile &undo)
+{
+	undo.setOffset(of.getOffset());
+	undo.setModel(of.getModel());
+	undo.getData().assign(of.getData().size(), 0xff);
+	undo.setRegions(runs);
+
+	logi("Saving previous contents of %u bytes", region::totalSize(runs));
+	for (const auto &r: runs)
+	{
+		if (!session.read(&undo.getData()[r.offset], r.offset, r.size))
+			return false;
+	}
+
+	return true;
+}
+
+// undo file holds previous contents only for the data it was saved
+// for, so hash of that data is kept next to it
+static std::string undoKeyPath(const std::string &path)
+{
+	return path + ".key";
+}
+
+static bool saveUndo(const COmiFile &undo, const std::string &path, const std::string &hash)
+{
+	CTextFile tf;
+	tf.add(1, hash.c_str());
+	return undo.write(path) && tf.write(undoKeyPath(path), true);
+}
+
+static bool loadUndo(const std::string &path, const std::string &model, const std::string &hash, COmiFile &undo)
+{
+	if (access(path.c_str(), F_OK) != 0)
+		return false;
+
+	CTextFile tf;
+	if (access(undoKeyPath(path).c_str(), F_OK) != 0 || !tf.read(undoKeyPath(path), true) || tf.get().size() != 1 ||
+		tf.get()[0] != CTextFile::TLine { hash } || !undo.read(path) || undo.getModel() != model)
+	{
+		logn("Ignoring %s, it doesn't hold previous contents of this radio for this data", path.c_str());
+		return false;
+	}
+
+	logd("Previous contents of radio memory loaded from %s", path.c_str());
+	return true;
+}
+
+static bool writeRuns(CSession &session, const std::vector<uint8_t> &data, const region::TList &list)
+{
+	for (const auto &r: list)
+	{
+		if (!session.write(&data[r.offset], r.offset, r.size))
+			return false;
+	}
+
+	return true;
+}
+
+// called with blocks which have been read back and match
+typedef std::function<void(uint16_t offset, uint16_t size)> TVerified;
+
+// reads back every chunk written before the last one, so the radio has
+// time to commit it, and writes blocks which differ again
+static bool writeVerified(CSession &session, const std::vector<uint8_t> &data, const region::TList &list, const TVerified &verified)
+{
+	std::vector<region::SRegion> chunks;
+	for (const auto &r: list)
+	{
+		const unsigned end(r.offset + r.size);
+		for (unsigned ofs(r.offset); ofs < end; ofs += config::VERIFY_CHUNK)
+			chunks.push_back(region::SRegion { uint16_t(ofs), uint16_t(std::min<unsigned>(config::VERIFY_CHUNK, end - ofs)) });
+	}
+
+	region::TList bad;
+	std::vector<uint8_t> buf;
+	auto check([&](const region::SRegion &r)
+	{
+		buf.resize(r.size);
+		if (!session.read(&buf[0], r.offset, r.size))
+			return false;
+
+		// start of matching blocks not reported yet
+		unsigned good(r.offset);
+		for (unsigned i(0); i < r.size; i += config::PACKET_SIZE)
+		{
+			if (!memcmp(&buf[i], &data[r.offset + i], config::PACKET_SIZE))
+				continue;
+
+			logn("Data at offset 0x%04x differs after writing", r.offset + i);
+			bad.push_back(region::SRegion { uint16_t(r.offset + i), uint16_t(config::PACKET_SIZE) });
+
+			if (verified && r.offset + i > good)
+				verified(good, r.offset + i - good);
+
+			good = r.offset + i + config::PACKET_SIZE;
+		}
+
+		if (verified && r.offset + r.size > good)
+			verified(good, r.offset + r.size - good);
+
+		return true;
+	});
+
+	for (size_t i(0); i < chunks.size(); ++i)
+	{
+		if (!session.write(&data[chunks[i].offset], chunks[i].offset, chunks[i].size))
+			return false;
+
+		if (i > 0 && !check(chunks[i - 1]))
+			return false;
+	}
+
+	if (!chunks.empty() && !check(chunks.back()))
+		return false;
+
+	for (unsigned attempt(1); !bad.empty(); ++attempt)
+	{
+		region::normalize(bad);
+		if (attempt > config::MAX_VERIFY_RETRIES)
+		{
+			loge("Data at %s still differs after %u attempts", region::toString(bad).c_str(), config::MAX_VERIFY_RETRIES);
+			return false;
+		}
+
+		const region::TList again(bad);
+		bad.clear();
+
+		for (const auto &r: again)
+		{
+			if (!session.write(&data[r.offset], r.offset, r.size))
+				return false;
+		}
+
+		for (const auto &r: again)
+		{
+			if (!check(r))
+				return false;
+		}
+	}
+
+	logi("Verified %u bytes", region::totalSize(list));
+	return true;
+}
+
 bool applet::CWrite::run(int argc, char * const argv[])
 {
 	cli::CWrite cli;
@@ -64,23 +214,22 @@ bool applet::CWrite::run(int argc, char * const argv[])
 		return false;
 	}
 
-	xassert(of.getData().size() <= UINT16_MAX, "Vector too large, should not happen with 16-bit size in .omi header");
-
-	CPort port(cli.getPort(), config::PORT_TIMEOUT);
-	if (!port.isOpen())
+	for (const auto &r: of.getRegions())
 	{
-		loge("Error opening communication port");
-		return false;
+		if (r.offset % config::PACKET_SIZE || r.size % config::PACKET_SIZE)
+		{
+			loge("Region 0x%04x-0x%04x is not aligned to packet size", r.offset, r.offset + r.size);
+			return false;
+		}
 	}
 
-	std::string model;
-	if (!protocol::handshake(port, model))
-	{
-		loge("Protocol error during handshake");
+	xassert(of.getData().size() <= UINT16_MAX, "Vector too large, should not happen with 16-bit size in .omi header");
+
+	CSession session(cli.getPort(), cli.getWindow(), cli.getLowLatency());
+	if (!session.isOpen())
 		return false;
-	}
 
-	logn("Radio ID string: %s", util::toPrintable(model).c_str());
+	const std::string &model(session.getModel());
 	if (of.getModel() != (model.size() > config::MAX_MODEL_SIZE ? model.substr(0, config::MAX_MODEL_SIZE) : model))
 	{
 		loge("Radio model mismatch");
@@ -89,34 +238,153 @@ bool applet::CWrite::run(int argc, char * const argv[])
 		return false;
 	}
 
-	std::vector<uint8_t> &data(of.getData());
-	const uint16_t size(of.getData().size());
-	for (uint16_t ofs(0); ofs < size; ofs += config::PACKET_SIZE)
+	const std::vector<uint8_t> &data(of.getData());
+	const uint16_t size(data.size());
+
+	// data is read too, when verifying and saving previous contents
+	session.setProgress([size](uint16_t ofs, bool write)
+	{
+		logi("%s offset 0x%04x of 0x%04x (%u%%)", write ? "Writing" : "Reading", ofs, size, ofs * 100 / size);
+	});
+
+	// sparse files are written only where data is present; in
+	// differential mode, blocks missing from reference file are
+	// treated as changed. without reference file, only blocks marked
+	// as dirty by omi import are written, unless -f is given. areas not
+	// known to hold configuration are skipped, unless -a is given
+	const models::SModel &caps(session.getCaps());
+	region::TList regions(region::intersect(of.getRegions(), caps.writable));
+	if (!cli.getAll())
+		regions = region::intersect(regions, caps.writeMask);
+
+	const region::TList refRegions(rf.get() ? rf->getRegions() : region::TList());
+	const bool useDirty(!rf.get() && !cli.getFull() && !of.getDirty().empty());
+	auto changed([&](unsigned ofs)
 	{
 		if (rf.get())
+			return !region::contains(refRegions, ofs, config::PACKET_SIZE) || memcmp(&data[ofs], &rf->getData()[ofs], config::PACKET_SIZE);
+
+		return !useDirty || region::contains(of.getDirty(), ofs, config::PACKET_SIZE);
+	});
+
+	if (useDirty)
+		logn("Writing only %u bytes changed since reading from radio; use -f to write everything",
+			region::totalSize(region::intersect(of.getDirty(), regions)));
+
+	logi("Writing regions %s", region::toString(regions).c_str());
+
+	// in differential mode, only ranges of changed blocks are written
+	region::TList runs;
+	for (const auto &r: regions)
+	{
+		for (unsigned ofs(r.offset); ofs < unsigned(r.offset + r.size); ofs += config::PACKET_SIZE)
 		{
-			if (!memcmp(&data[ofs], &rf->getData()[ofs], config::PACKET_SIZE))
-			{
+			if (changed(ofs))
+				runs.push_back(region::SRegion { uint16_t(ofs), uint16_t(config::PACKET_SIZE) });
+			else
 				logd("Data at offset 0x%04x did not change; not writing", ofs);
-				continue;
-			}
 		}
+	}
+
+	region::normalize(runs);
+
+	// blocks acknowledged by previous, interrupted write of the same
+	// data to the same radio model are not written again. with -V,
+	// only blocks which have been read back are recorded, and journals
+	// of writes with and without it are not mixed
+	CJournal journal(cli.getFile() + ".wjournal");
+	const std::string hash(util::format("%016llx", (unsigned long long) util::hash(&data[0], data.size())));
+	const std::string key(model + "\t" + hash + (cli.getVerify() ? "\tV" : ""));
+	const bool resuming(journal.load(key));
+	if (resuming)
+	{
+		region::TList acked;
+		for (const auto &rec: journal.getRecords())
+			acked.push_back(region::SRegion { rec.offset, rec.size });
+
+		region::normalize(acked);
+		const unsigned total(region::totalSize(runs));
+		runs = region::subtract(runs, acked);
+		logn("Resuming interrupted write, %u of %u bytes already written according to %s", total - region::totalSize(runs),
+			total, journal.getPath().c_str());
+	}
+
+	// in transactional mode, previous contents of blocks about to be
+	// written are saved first, and restored if writing fails. when
+	// resuming, contents saved by the first attempt are still valid.
+	// it's the default only when writing changed blocks, as reading
+	// everything first would double the time of a full write
+	const bool differential(rf.get() || useDirty);
+	const bool transactional(cli.getTransactional() && (differential || cli.getTransactionalFull()) && !runs.empty());
+	const std::string undoPath(cli.getFile() + ".undo.omi");
+	COmiFile undo;
+	if (transactional && !(resuming && loadUndo(undoPath, of.getModel(), hash, undo)))
+	{
+		if (resuming)
+			logn("Previous contents of blocks written before interruption are not known, they will not be restored on error");
 
-		logi("Writing offset 0x%04x of 0x%04x (%u%%)", ofs, size, ofs * 100 / size);
-		if (!protocol::write(port, &data[ofs], ofs, config::PACKET_SIZE))
+		if (!readPreImage(session, of, runs, undo) || !saveUndo(undo, undoPath, hash))
 		{
-			loge("Protocol error during write (offset 0x%04x)", ofs);
-			if (!protocol::end(port))
-				loge("Additional error while trying to terminate session");
+			loge("Cannot save previous contents of radio memory; nothing has been written");
 			return false;
 		}
 	}
 
-	if (!protocol::end(port))
+	if (!journal.open(key))
+		logn("Write will not be resumable if interrupted");
+
+	auto record([&journal](uint16_t ofs, uint16_t size)
+	{
+		journal.append(ofs, size, NULL);
+	});
+
+	if (!cli.getVerify())
+	{
+		session.setCommit([&record](uint16_t ofs, uint16_t size, bool written)
+		{
+			if (written)
+				record(ofs, size);
+		});
+	}
+
+	if (!(cli.getVerify() ? writeVerified(session, data, runs, record) : writeRuns(session, data, runs)))
 	{
-		loge("Protocol error during termination");
+		if (!transactional)
+		{
+			loge("Radio is partially programmed; repeat the command to write the rest (progress is kept in %s)", journal.getPath().c_str());
+			return false;
+		}
+
+		// repeated command would skip blocks restored before an error,
+		// so resuming is no longer possible
+		journal.remove();
+		unlink(undoKeyPath(undoPath).c_str());
+
+		const region::TList &saved(undo.getRegions());
+		logn("Writing failed, restoring previous contents of %u bytes", region::totalSize(saved));
+		if (!(cli.getVerify() ? writeVerified(session, undo.getData(), saved, TVerified()) : writeRuns(session, undo.getData(), saved)))
+		{
+			loge("Cannot restore previous contents; write %s with omi write%s to restore them", undoPath.c_str(), cli.getAll() ? " -a" : "");
+			return false;
+		}
+
+		if (!session.close())
+		{
+			loge("Previous contents have been restored, but session could not be terminated; if in doubt, write %s with omi write%s",
+				undoPath.c_str(), cli.getAll() ? " -a" : "");
+			return false;
+		}
+
+		unlink(undoPath.c_str());
+		loge("Writing failed, previous contents of radio memory have been restored");
 		return false;
 	}
 
+	if (!session.close())
+		return false;
+
+	// undo file is kept, so the write can be undone
+	journal.remove();
+	unlink(undoKeyPath(undoPath).c_str());
 	return true;
 }
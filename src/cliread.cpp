@@ -5,16 +5,25 @@
  */
 
 #include <cstdio>
+#include <cstdlib>
 #include "cliread.h"
+#include "models.h"
 #include "config.h"
 #include "util.h"
 #include "log.h"
 
-cli::CRead::CRead()
+cli::CRead::CRead(): m_isExportText(false), m_window(1), m_lowLatency(false)
 {
 	add('o', true, "Output .omi file path");
+	add('t', true, "Export to text file path while reading (like omi export)");
+	add('c', true, "Export to .csv file path while reading (like omi export)");
 	add('p', true, util::format("Port to use (default: %s)", config::DFL_PORT));
-	setSummary("read", "-o <output.omi> [-p <port>]");
+	add('w', true, util::format("Number of read requests in flight, 1-%u (default: 1)", config::MAX_WINDOW));
+	add('l', false, "Enable low latency mode of USB serial adapter (may need root)");
+	add('s', true, "Read only selected regions: profiles (channels, settings, config, vendor, all) or start-end hex ranges, comma-separated");
+	add('f', true, "Regions to read first, same format as -s (default: config)");
+	add('e', true, "Write regions read first to this .omi file as soon as they're complete");
+	setSummary("read", "-o <output.omi>|-t <file.txt>|-c <file.csv> [-p <port>] [-w <window>] [-s <regions>] [-f <regions>] [-e <early.omi>]");
 }
 
 const std::string &cli::CRead::getPort() const
@@ -27,13 +36,98 @@ const std::string &cli::CRead::getFile() const
 	return m_file;
 }
 
+unsigned cli::CRead::getWindow() const
+{
+	return m_window;
+}
+
+bool cli::CRead::getLowLatency() const
+{
+	return m_lowLatency;
+}
+
+const std::string &cli::CRead::getRegions() const
+{
+	return m_regions;
+}
+
+const std::string &cli::CRead::getPriority() const
+{
+	return m_priority;
+}
+
+const std::string &cli::CRead::getEarlyFile() const
+{
+	return m_earlyFile;
+}
+
+const std::string &cli::CRead::getExportFile() const
+{
+	return m_exportFile;
+}
+
+bool cli::CRead::isExportText() const
+{
+	return m_isExportText;
+}
+
 std::string cli::CRead::parsed()
 {
 	m_port = exists('p') ? get('p') : config::DFL_PORT;
 
-	if (!exists('o'))
+	if (!exists('o') && !exists('t') && !exists('c'))
 		return "Output file not specified";
 
-	m_file = get('o');
+	if (exists('t') && exists('c'))
+		return "Only one of -c or -t must be specified";
+
+	if (exists('o'))
+		m_file = get('o');
+
+	if (exists('c'))
+	{
+		m_exportFile = get('c');
+		m_isExportText = false;
+	}
+	else if (exists('t'))
+	{
+		m_exportFile = get('t');
+		m_isExportText = true;
+	}
+
+	m_lowLatency = exists('l');
+
+	if (exists('s'))
+	{
+		m_regions = get('s');
+		if (m_regions.empty())
+			return "Empty region list";
+
+		std::string invalid;
+		if (!models::checkRegions(m_regions, invalid))
+			return "Unknown profile or invalid range: " + invalid;
+	}
+
+	if (exists('f'))
+	{
+		m_priority = get('f');
+		if (m_priority.empty())
+			return "Empty priority region list";
+
+		std::string invalid;
+		if (!models::checkRegions(m_priority, invalid))
+			return "Unknown profile or invalid priority range: " + invalid;
+	}
+
+	if (exists('e'))
+		m_earlyFile = get('e');
+
+	if (exists('w'))
+	{
+		m_window = strtoul(get('w').c_str(), NULL, 10);
+		if (m_window < 1 || m_window > config::MAX_WINDOW)
+			return "Window non-numeric or out of range";
+	}
+
 	return "";
 }
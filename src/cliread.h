@@ -17,13 +17,36 @@ namespace cli
 		virtual ~CRead() {}
 
 		const std::string &getPort() const;
+		// empty if .omi file is not to be written
 		const std::string &getFile() const;
 
+		// empty if memory is not to be exported while being read
+		const std::string &getExportFile() const;
+		bool isExportText() const;
+		unsigned getWindow() const;
+		bool getLowLatency() const;
+
+		// empty if whole memory is to be read
+		const std::string &getRegions() const;
+
+		// empty if model default is to be used
+		const std::string &getPriority() const;
+
+		// empty if no early file is to be written
+		const std::string &getEarlyFile() const;
+
 	protected:
 		virtual std::string parsed();
 
 	private:
 		std::string m_port;
 		std::string m_file;
+		std::string m_exportFile;
+		bool m_isExportText;
+		unsigned m_window;
+		bool m_lowLatency;
+		std::string m_regions;
+		std::string m_priority;
+		std::string m_earlyFile;
 	};
 }
@@ -5,17 +5,25 @@
  */
 
 #include <cstdio>
+#include <cstdlib>
 #include "cliwrite.h"
 #include "config.h"
 #include "util.h"
 #include "log.h"
 
-cli::CWrite::CWrite()
+cli::CWrite::CWrite(): m_window(1), m_lowLatency(false), m_full(false), m_all(false), m_verify(false), m_transactional(true), m_transactionalFull(false)
 {
 	add('i', true, "Input .omi file path");
 	add('r', true, "Original (reference) .omi file path for differential upload");
 	add('p', true, util::format("Port to use (default: %s)", config::DFL_PORT));
-	setSummary("write", "-i <input.omi> [-r <reference.omi>] [-p <port>]");
+	add('w', true, util::format("Number of write frames in flight, 1-%u (default: 1; cables with echo always use 1)", config::MAX_WINDOW));
+	add('l', false, "Enable low latency mode of USB serial adapter (may need root)");
+	add('f', false, "Write all data, even if input file tells which blocks have been changed");
+	add('a', false, "Write everything, also memory not known to hold configuration (filler and radio-specific data past 0x32a0)");
+	add('V', false, "Verify: read back written data and write blocks which differ again");
+	add('n', false, "Non-transactional: don't save previous contents of written blocks, and don't restore them on error");
+	add('T', false, "Transactional also when writing everything (previous contents are read first, so it takes twice as long)");
+	setSummary("write", "-i <input.omi> [-r <reference.omi>] [-p <port>] [-w <window>]");
 }
 
 const std::string &cli::CWrite::getPort() const
@@ -33,6 +41,41 @@ const std::string &cli::CWrite::getRefFile() const
 	return m_refFile;
 }
 
+unsigned cli::CWrite::getWindow() const
+{
+	return m_window;
+}
+
+bool cli::CWrite::getLowLatency() const
+{
+	return m_lowLatency;
+}
+
+bool cli::CWrite::getFull() const
+{
+	return m_full;
+}
+
+bool cli::CWrite::getAll() const
+{
+	return m_all;
+}
+
+bool cli::CWrite::getVerify() const
+{
+	return m_verify;
+}
+
+bool cli::CWrite::getTransactional() const
+{
+	return m_transactional;
+}
+
+bool cli::CWrite::getTransactionalFull() const
+{
+	return m_transactionalFull;
+}
+
 std::string cli::CWrite::parsed()
 {
 	m_port = exists('p') ? get('p') : config::DFL_PORT;
@@ -45,5 +88,25 @@ std::string cli::CWrite::parsed()
 	if (exists('r'))
 		m_refFile = get('r');
 
+	m_lowLatency = exists('l');
+	m_full = exists('f');
+	m_all = exists('a');
+	m_verify = exists('V');
+	m_transactional = !exists('n');
+	m_transactionalFull = exists('T');
+
+	if (m_full && exists('r'))
+		return "Only one of -f or -r can be specified";
+
+	if (!m_transactional && m_transactionalFull)
+		return "Only one of -n or -T can be specified";
+
+	if (exists('w'))
+	{
+		m_window = strtoul(get('w').c_str(), NULL, 10);
+		if (m_window < 1 || m_window > config::MAX_WINDOW)
+			return "Window non-numeric or out of range";
+	}
+
 	return "";
 }
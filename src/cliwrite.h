@@ -19,6 +19,13 @@ namespace cli
 		const std::string &getPort() const;
 		const std::string &getFile() const;
 		const std::string &getRefFile() const;
+		unsigned getWindow() const;
+		bool getLowLatency() const;
+		bool getFull() const;
+		bool getAll() const;
+		bool getVerify() const;
+		bool getTransactional() const;
+		bool getTransactionalFull() const;
 
 	protected:
 		virtual std::string parsed();
@@ -27,5 +34,12 @@ namespace cli
 		std::string m_port;
 		std::string m_file;
 		std::string m_refFile;
+		unsigned m_window;
+		bool m_lowLatency;
+		bool m_full;
+		bool m_all;
+		bool m_verify;
+		bool m_transactional;
+		bool m_transactionalFull;
 	};
 }
@@ -12,16 +12,70 @@ namespace config
 
 	static const char DFL_PORT[]		= "/dev/ttyUSB0";
 
-	// in seconds
-	static const unsigned PORT_TIMEOUT	= 5;
+	// in milliseconds; used for handshake and until radio turnaround
+	// is known, after that time budgets are computed for each packet
+	static const unsigned PORT_TIMEOUT	= 5000;
 
-	// currently fixed; might be changed to argument
-	// for now, ..._MEMORY_SIZE must be multiple of PACKET_SIZE
+	// in milliseconds; added to every time budget to account for
+	// scheduling and USB adapter latency
+	static const unsigned BUDGET_MARGIN	= 40;
+
+	// port is fixed to 9600 8N1, so 10 bits per byte
+	static const unsigned PORT_BAUD		= 9600;
+	static const unsigned BITS_PER_BYTE	= 10;
+
+	// inter-frame gap, in microseconds; default one is used before
+	// anything is learned about the radio
+	static const unsigned PACE_DEFAULT_GAP	= 5000;
+	static const unsigned PACE_STEP		= 250;
+	static const unsigned PACE_MAX_GAP	= 50000;
+	static const unsigned PACE_TURNAROUND_STEP	= 20000;
+	static const unsigned PACE_MAX_TURNAROUND	= 500000;
+
+	// in milliseconds; latency timer of FTDI adapters in low latency
+	// mode (default is 16)
+	static const unsigned FTDI_LATENCY_TIMER	= 1;
+
+	// must fit echo of the largest burst
+	static const unsigned RX_BUFFER_SIZE	= 4096;
+
+	// in milliseconds; line must be silent for this long before
+	// input is flushed after an error
+	static const unsigned QUIET_TIME	= 100;
+
+	// minimum packet size, supported by all radios
+	// memory regions of models (see models.h) must be aligned to it
 	static const unsigned PACKET_SIZE	= 0x10;
 
-	// FULL_MEMORY_SIZE is number of bytes read by the original utility
-	static const unsigned MEMORY_SIZE	= 0x4000;
-	// static const unsigned CHAN_MEMORY_SIZE	= 0x1990;
+	// largest packet size to probe for; must be PACKET_SIZE
+	// multiplied by power of two, and fit in the length byte
+	static const unsigned MAX_PACKET_SIZE	= 0x80;
+
+	// number of times packet size is probed before it's given up on,
+	// if radio doesn't respond at all
+	static const unsigned PROBE_ATTEMPTS	= 2;
+
+	// maximum number of requests sent at once in burst mode
+	static const unsigned MAX_WINDOW	= 8;
+
+	// after this many consecutive successful packets, packet
+	// size decreased because of errors is doubled back
+	static const unsigned PKT_GROW_AFTER	= 16;
+
+	// number of times a packet is retried after an error which
+	// did not make packet size or pacing change
+	static const unsigned MAX_RETRIES	= 3;
+
+	// omi write -V reads back data in chunks of this size, after
+	// the next chunk has been written; multiple of PACKET_SIZE
+	static const unsigned VERIFY_CHUNK	= 0x100;
+
+	// number of times blocks which differ after writing are written
+	// again
+	static const unsigned MAX_VERIFY_RETRIES	= 3;
+
+	// file in user's home directory with learned link parameters
+	static const char LINK_CACHE[]		= ".omi-link";
 
 	// this is the theoretical size of model name that radio can
 	// send (it's truncated to 16 bytes in .omi file anyway). any
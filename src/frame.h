@@ -0,0 +1,112 @@
+/**
+ * \brief	Read and write frame codec
+ * \author	Circuit Chaos
+ * \date	2020-04-04
+ *
+ * Frames are:
+ * - read request: R, offset (big endian), size
+ * - read response and write request: W, offset, size, data, checksum,
+ *   ACK (0x06)
+ *
+ * Checksum is a sum of all bytes between W and checksum.
+ *
+ * Payload size N is known at compile time, so the compiler can unroll
+ * the loops for common packet sizes; CFrame<0> is the fallback for any
+ * other size, which is then given at runtime.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+#include <cstddef>
+#include <cstring>
+
+template<size_t N> class CFrame
+{
+public:
+	static const size_t CMD_OFFSET		= 0;
+	static const size_t ADDR_OFFSET		= 1;
+	static const size_t SIZE_OFFSET		= 3;
+	static const size_t DATA_OFFSET		= 4;
+
+	// header and read request size
+	static const size_t HDR_SIZE		= DATA_OFFSET;
+
+	// header, checksum and ACK
+	static const size_t OVERHEAD		= HDR_SIZE + 2;
+
+	static const uint8_t ACK		= 0x06;
+
+	explicit CFrame(uint8_t size = N): m_size(N ? N : size)
+	{
+	}
+
+	uint8_t getSize() const
+	{
+		return N ? N : m_size;
+	}
+
+	// size of the read response or write request
+	size_t getFrameSize() const
+	{
+		return getSize() + OVERHEAD;
+	}
+
+	// returns number of bytes written to p (HDR_SIZE)
+	size_t encodeRead(uint8_t *p, uint16_t offset) const
+	{
+		encodeHdr(p, 'R', offset);
+		return HDR_SIZE;
+	}
+
+	// returns number of bytes written to p (getFrameSize())
+	size_t encodeWrite(uint8_t *p, uint16_t offset, const uint8_t *data) const
+	{
+		encodeHdr(p, 'W', offset);
+		memcpy(&p[DATA_OFFSET], data, getSize());
+		p[DATA_OFFSET + getSize()] = checksum(p);
+		p[DATA_OFFSET + getSize() + 1] = ACK;
+		return getFrameSize();
+	}
+
+	// checks everything except offset and checksum
+	bool isResponse(const uint8_t *rsp) const
+	{
+		return rsp[CMD_OFFSET] == 'W' && rsp[SIZE_OFFSET] == getSize() && rsp[DATA_OFFSET + getSize() + 1] == ACK;
+	}
+
+	bool checksumValid(const uint8_t *rsp) const
+	{
+		return rsp[DATA_OFFSET + getSize()] == checksum(rsp);
+	}
+
+	static uint16_t getOffset(const uint8_t *rsp)
+	{
+		return (rsp[ADDR_OFFSET] << 8) | rsp[ADDR_OFFSET + 1];
+	}
+
+	static const uint8_t *getData(const uint8_t *rsp)
+	{
+		return &rsp[DATA_OFFSET];
+	}
+
+private:
+	const uint8_t m_size;
+
+	void encodeHdr(uint8_t *p, uint8_t cmd, uint16_t offset) const
+	{
+		p[CMD_OFFSET] = cmd;
+		p[ADDR_OFFSET] = offset >> 8;
+		p[ADDR_OFFSET + 1] = offset & 0xff;
+		p[SIZE_OFFSET] = getSize();
+	}
+
+	uint8_t checksum(const uint8_t *p) const
+	{
+		uint8_t sum(0);
+		for (size_t i(ADDR_OFFSET); i < DATA_OFFSET + getSize(); ++i)
+			sum += p[i];
+
+		return sum;
+	}
+};
@@ -8,6 +8,7 @@
 
 #include <string>
 #include <inttypes.h>
+#include "region.h"
 
 namespace impexp
 {
@@ -76,7 +77,6 @@ namespace impexp
 		static const char DCS_INVERT_FLAG	= 'i';
 	}
 
-	static const unsigned NUM_CHANNELS	= 200;
 	static const unsigned CHAN_EN_OFFSET	= 0x1940;
 	static const unsigned SCANNING_OFFSET	= 0x1960;
 	static const unsigned WELCOME_OFFSET	= 0x1980;
@@ -87,6 +87,12 @@ namespace impexp
 	static const unsigned APON_OFFSET	= 0x320a;
 	static const unsigned KEY_FLAGS_OFFSET	= 0x321b;
 
+	// memory accessed by export and import; files read only partially
+	// (omi read -s) must contain it
+	static const unsigned CHANNELS_END	= 0x1990;
+	static const unsigned SETTINGS_OFFSET	= 0x3200;
+	static const unsigned SETTINGS_END	= 0x32a0;
+
 	static const char * const CTSTBL[] =
 	{
 		"62.5",		// 0x00
@@ -286,6 +292,11 @@ namespace impexp
 		bool dunno7:1;
 	} __attribute__((packed));
 
+	static inline bool hasConfig(const region::TList &regions)
+	{
+		return region::contains(regions, 0, CHANNELS_END) && region::contains(regions, SETTINGS_OFFSET, SETTINGS_END - SETTINGS_OFFSET);
+	}
+
 	static inline bool getFlag(const uint8_t *memory, unsigned position)
 	{
 		return memory[position / 8] & (1 << (position % 8));
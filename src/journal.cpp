@@ -0,0 +1,171 @@
+/**
+ * \brief	Transfer journal
+ * \author	Circuit Chaos
+ * \date	2020-04-10
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <endian.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "journal.h"
+#include "rawfile.h"
+#include "throw.h"
+#include "log.h"
+
+CJournal::CJournal(const std::string &path):
+	m_path(path),
+	m_loaded(false)
+{
+}
+
+const std::string &CJournal::getPath() const
+{
+	return m_path;
+}
+
+bool CJournal::load(const std::string &key)
+{
+	m_records.clear();
+	m_loaded = false;
+
+	if (access(m_path.c_str(), F_OK) != 0)
+		return false;
+
+	CRawReader r(m_path);
+	if (!r.isOpen())
+		return false;
+
+	uint32_t magic;
+	uint16_t version;
+	uint16_t keySize;
+	if (!r(&magic, sizeof(magic)) || !r(&version, sizeof(version)) || !r(&keySize, sizeof(keySize)) ||
+		be32toh(magic) != MAGIC || be16toh(version) != VERSION)
+	{
+		logn("%s: invalid journal, ignoring it", m_path.c_str());
+		return false;
+	}
+
+	std::string fileKey(be16toh(keySize), '\0');
+	if (!fileKey.empty() && !r(&fileKey[0], fileKey.size()))
+	{
+		logn("%s: invalid journal, ignoring it", m_path.c_str());
+		return false;
+	}
+
+	if (fileKey != key)
+	{
+		logn("%s: journal belongs to different radio or data, ignoring it", m_path.c_str());
+		return false;
+	}
+
+	for (;;)
+	{
+		uint16_t hdr[2];
+		uint8_t flag;
+		if (!r(hdr, sizeof(hdr)) || !r(&flag, sizeof(flag)))
+			break;
+
+		SRecord rec;
+		rec.offset = be16toh(hdr[0]);
+		rec.size = be16toh(hdr[1]);
+		if (flag)
+		{
+			rec.data.resize(rec.size);
+			if (!r(&rec.data[0], rec.size))
+				break;
+		}
+
+		m_records.push_back(rec);
+	}
+
+	logd("%s: %zu records loaded", m_path.c_str(), m_records.size());
+	m_loaded = true;
+	return true;
+}
+
+const std::vector<CJournal::SRecord> &CJournal::getRecords() const
+{
+	return m_records;
+}
+
+bool CJournal::open(const std::string &key)
+{
+	xassert(key.size() <= UINT16_MAX, "Journal key too long");
+
+	if (m_loaded)
+	{
+		// truncated record at the end, if any, is overwritten
+		size_t size(2 * sizeof(uint16_t) + sizeof(uint32_t) + key.size());
+		for (const auto &rec: m_records)
+			size += 2 * sizeof(uint16_t) + sizeof(uint8_t) + rec.data.size();
+
+		m_fd = ::open(m_path.c_str(), O_WRONLY);
+		if (m_fd == -1 || ftruncate(m_fd, size) != 0 || lseek(m_fd, size, SEEK_SET) == (off_t) -1)
+		{
+			loge("%s: cannot open journal: %m", m_path.c_str());
+			m_fd = -1;
+			return false;
+		}
+
+		return true;
+	}
+
+	m_fd = ::open(m_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (m_fd == -1)
+	{
+		loge("%s: cannot create journal: %m", m_path.c_str());
+		return false;
+	}
+
+	std::vector<uint8_t> hdr(sizeof(uint32_t) + 2 * sizeof(uint16_t));
+	const uint32_t magic(htobe32(MAGIC));
+	const uint16_t version(htobe16(VERSION));
+	const uint16_t keySize(htobe16(key.size()));
+	memcpy(&hdr[0], &magic, sizeof(magic));
+	memcpy(&hdr[4], &version, sizeof(version));
+	memcpy(&hdr[6], &keySize, sizeof(keySize));
+	hdr.insert(hdr.end(), key.begin(), key.end());
+
+	return write(&hdr[0], hdr.size());
+}
+
+void CJournal::append(uint16_t offset, uint16_t size, const uint8_t *data)
+{
+	if (m_fd == -1)
+		return;
+
+	// one write per record, so only the last one can be truncated
+	std::vector<uint8_t> rec(2 * sizeof(uint16_t) + sizeof(uint8_t));
+	const uint16_t hdr[2] = { htobe16(offset), htobe16(size) };
+	memcpy(&rec[0], hdr, sizeof(hdr));
+	rec[4] = data ? 1 : 0;
+	if (data)
+		rec.insert(rec.end(), data, data + size);
+
+	write(&rec[0], rec.size());
+}
+
+void CJournal::remove()
+{
+	m_fd = -1;
+	m_records.clear();
+	m_loaded = false;
+
+	logd("Removing journal %s", m_path.c_str());
+	if (unlink(m_path.c_str()) != 0 && errno != ENOENT)
+		loge("%s: cannot remove journal: %m", m_path.c_str());
+}
+
+bool CJournal::write(const void *p, size_t size)
+{
+	if (::write(m_fd, p, size) != (ssize_t) size)
+	{
+		loge("%s: journal write error, continuing without it", m_path.c_str());
+		m_fd = -1;
+		return false;
+	}
+
+	return true;
+}
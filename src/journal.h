@@ -0,0 +1,69 @@
+/**
+ * \brief	Transfer journal
+ * \author	Circuit Chaos
+ * \date	2020-04-10
+ *
+ * Append-only file recording packets as they are transferred, so an
+ * interrupted session can be resumed. Journal starts with a key
+ * identifying what it belongs to (radio model, image); records hold
+ * offset and size, and optionally data.
+ *
+ * On disk, all integers are in BE byte order:
+ * - header: magic (OMJ!, 4 bytes), version (2 bytes, currently 1),
+ *   key size (2 bytes), key
+ * - record: offset (2 bytes), size (2 bytes), data flag (1 byte),
+ *   data (size bytes, only if flag is 1)
+ *
+ * Every record is flushed as soon as it's appended; truncated record
+ * at the end (if program was killed while writing it) is ignored.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <inttypes.h>
+#include "fd.h"
+
+class CJournal
+{
+public:
+	struct SRecord
+	{
+		uint16_t offset;
+		uint16_t size;
+
+		// empty if record has no data
+		std::vector<uint8_t> data;
+	};
+
+	CJournal(const std::string &path);
+
+	const std::string &getPath() const;
+
+	// reads existing journal; returns false if there's none, or if
+	// it's unreadable or its key differs
+	bool load(const std::string &key);
+	const std::vector<SRecord> &getRecords() const;
+
+	// appends to loaded journal, or starts a new one
+	bool open(const std::string &key);
+
+	// data can be NULL; after write error, journal is closed and
+	// further records are ignored
+	void append(uint16_t offset, uint16_t size, const uint8_t *data);
+
+	// called when journal is no longer needed
+	void remove();
+
+private:
+	static const uint32_t MAGIC = 0x4f4d4a21;	// "OMJ!"
+	static const uint16_t VERSION = 1;
+
+	const std::string m_path;
+	std::vector<SRecord> m_records;
+	bool m_loaded;
+	CFd m_fd;
+
+	bool write(const void *p, size_t size);
+};
@@ -0,0 +1,148 @@
+/**
+ * \brief	Persistent cache of learned link parameters
+ * \author	Circuit Chaos
+ * \date	2020-04-02
+ */
+
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include "linkcache.h"
+#include "fd.h"
+#include "textfile.h"
+#include "config.h"
+#include "log.h"
+
+CLinkCache::CLinkCache()
+{
+	const char *home(getenv("HOME"));
+	if (!home)
+	{
+		logd("HOME not set, link cache disabled");
+		return;
+	}
+
+	m_path = std::string(home) + "/" + config::LINK_CACHE;
+	if (access(m_path.c_str(), R_OK) != 0)
+	{
+		logd("Link cache %s does not exist yet", m_path.c_str());
+		return;
+	}
+
+	const CFd fd(lock(LOCK_SH));
+	load();
+}
+
+bool CLinkCache::get(const std::string &key, unsigned &value) const
+{
+	const auto &i(m_values.find(key));
+	if (i == m_values.end())
+		return false;
+
+	value = i->second;
+	return true;
+}
+
+void CLinkCache::set(const std::string &key, unsigned value)
+{
+	m_values[key] = value;
+	m_changed[key] = value;
+}
+
+bool CLinkCache::save()
+{
+	if (m_path.empty() || m_changed.empty())
+		return true;
+
+	// another instance might have saved its values since this one was
+	// loaded, so file is loaded again under lock before being replaced
+	const CFd fd(lock(LOCK_EX));
+	if (fd == -1)
+		return false;
+
+	load();
+	for (const auto &i: m_changed)
+		m_values[i.first] = i.second;
+
+	std::string data;
+	for (const auto &i: m_values)
+		data += CTextFile::format({i.first, std::to_string(i.second)}, true) + '\n';
+
+	// unique temporary file, renamed over the cache only when complete,
+	// so the cache is never seen half-written
+	std::string tmpPath(m_path + ".XXXXXX");
+	const CFd tmp(mkstemp(&tmpPath[0]));
+	if (tmp == -1)
+	{
+		loge("Cannot create temporary file for link cache %s: %m", m_path.c_str());
+		return false;
+	}
+
+	if (write(tmp, data.data(), data.size()) != (ssize_t) data.size() || fsync(tmp) != 0 || rename(tmpPath.c_str(), m_path.c_str()) != 0)
+	{
+		loge("Cannot write link cache %s: %m", m_path.c_str());
+		unlink(tmpPath.c_str());
+		return false;
+	}
+
+	m_changed.clear();
+	return true;
+}
+
+int CLinkCache::lock(int op) const
+{
+	const std::string path(m_path + ".lock");
+	CFd fd(open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644));
+	if (fd == -1)
+	{
+		loge("Cannot open link cache lock %s: %m", path.c_str());
+		return -1;
+	}
+
+	while (flock(fd, op) != 0)
+	{
+		if (errno != EINTR)
+		{
+			loge("Cannot lock link cache %s: %m", path.c_str());
+			return -1;
+		}
+	}
+
+	return fd.release();
+}
+
+void CLinkCache::load()
+{
+	if (access(m_path.c_str(), R_OK) != 0)
+		return;
+
+	CTextFile tf;
+	if (!tf.read(m_path, true))
+	{
+		loge("Cannot read link cache %s, ignoring it", m_path.c_str());
+		return;
+	}
+
+	for (const auto &line: tf.get())
+	{
+		// value must be a complete number, so a damaged line isn't
+		// taken as zero
+		char *end;
+		if (line.size() != 2 || line[1].empty() || !isdigit((unsigned char) line[1][0]))
+			continue;
+
+		const unsigned long value(strtoul(line[1].c_str(), &end, 10));
+		if (*end || value > UINT_MAX)
+		{
+			logd("Link cache: ignoring invalid value of %s", line[0].c_str());
+			continue;
+		}
+
+		m_values[line[0]] = value;
+		logd("Link cache: %s = %s", line[0].c_str(), line[1].c_str());
+	}
+}
@@ -0,0 +1,41 @@
+/**
+ * \brief	Persistent cache of learned link parameters
+ * \author	Circuit Chaos
+ * \date	2020-04-02
+ *
+ * Stored as a tab-separated text file in user's home directory,
+ * one key and value per line. Keys are built by the caller (they
+ * usually contain printable model name).
+ *
+ * Several instances of omi may use the cache at once, so it's
+ * accessed under a lock, and saving merges values set by this
+ * instance into the file as it is at that moment.
+ */
+
+#pragma once
+
+#include <string>
+#include <map>
+
+class CLinkCache
+{
+public:
+	// loads the cache; missing file is not an error
+	CLinkCache();
+
+	bool get(const std::string &key, unsigned &value) const;
+	void set(const std::string &key, unsigned value);
+	bool save();
+
+private:
+	typedef std::map<std::string, unsigned> TValues;
+
+	std::string m_path;
+	TValues m_values;
+	// values set since loading, written over whatever is in the file
+	TValues m_changed;
+
+	// returns -1 on error
+	int lock(int op) const;
+	void load();
+};
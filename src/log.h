@@ -8,6 +8,8 @@
 
 #pragma once
 
+#include <cstddef>
+
 #define LOG_GENERIC(level, ...) xlog::doLog(level, __FILE__, __LINE__, __VA_ARGS__)
 #define logdump(prefix, data, size) xlog::doDump(xlog::LL_DBG, __FILE__, __LINE__, prefix, data, size)
 #define logd(...) LOG_GENERIC(xlog::LL_DBG, __VA_ARGS__)
@@ -0,0 +1,154 @@
+/**
+ * \brief	Radio model capabilities
+ * \author	Circuit Chaos
+ * \date	2020-04-08
+ */
+
+#include "models.h"
+#include "protocol.h"
+#include "config.h"
+#include "log.h"
+#include "util.h"
+
+// channel table with its flags and welcome message, and keys with
+// other configuration; needed by omi export and import
+static const region::TList MICRON_CONFIG = { { 0x0000, 0x1990 }, { 0x3200, 0x00a0 } };
+
+static const std::vector<models::SProfile> MICRON_PROFILES =
+{
+	{ "channels",	{ MICRON_CONFIG[0] } },
+	{ "settings",	{ MICRON_CONFIG[1] } },
+	{ "config",	MICRON_CONFIG },
+	{ "vendor",	{ { 0x0000, 0x32a0 } } },
+	{ "all",	{ { 0x0000, 0x4000 } } },
+};
+
+// from memory map: channels with flags, passwords and other data
+// up to 0x30f0, and keys with settings; 0xff filler in between is not
+// written. the original software writes only up to 0x32a0; rest of
+// memory holds radio-specific data (like model name at 0x3ff8), so
+// it's written only with omi write -a
+static const region::TList MICRON_WRITE_MASK = { { 0x0000, 0x1990 }, { 0x1ad0, 0x1620 }, { 0x3200, 0x00a0 } };
+
+// model name, version and date, and tuning-like data
+static const region::TList MICRON_FINGERPRINT = { { 0x3b00, 0x0100 }, { 0x3f00, 0x00c0 } };
+
+// no radio with memory layout or limits different from CRT Micron UV
+// is known yet, so there's only the default entry; such radios get
+// their own entries, before the default one
+static const models::SModel MODELS[] =
+{
+	{
+		NULL, "CRT Micron UV",
+		0x4000, { { 0x0000, 0x4000 } }, { { 0x0000, 0x4000 } }, MICRON_WRITE_MASK,
+		MICRON_PROFILES, MICRON_CONFIG, MICRON_FINGERPRINT,
+		config::MAX_PACKET_SIZE, config::PACE_DEFAULT_GAP,
+		200,
+	},
+};
+
+// radios known to work with the default entry
+static const struct
+{
+	const char *name;
+	const char *descr;
+} KNOWN_RADIOS[] =
+{
+	{ "MICRON",	"CRT Micron UV" },
+	{ "778UV-P",	"AnyTone AT-778UV" },
+};
+
+const models::SModel &models::find(const std::string &model)
+{
+	protocol::SRadioId id;
+	const bool parsed(id.parse(model));
+	if (parsed)
+	{
+		for (const auto &m: MODELS)
+		{
+			if (m.name && id.name == m.name)
+			{
+				logd("Radio model: %s", m.descr);
+				return m;
+			}
+		}
+	}
+
+	const SModel &m(MODELS[sizeof(MODELS) / sizeof(*MODELS) - 1]);
+	if (parsed)
+	{
+		for (const auto &r: KNOWN_RADIOS)
+		{
+			if (id.name == r.name)
+			{
+				logd("Radio model: %s", r.descr);
+				return m;
+			}
+		}
+	}
+
+	logn("Unknown radio %s, assuming CRT Micron UV memory layout", util::toPrintable(model).c_str());
+	return m;
+}
+
+bool models::selectRegions(const SModel &model, const std::string &spec, region::TList &list)
+{
+	list.clear();
+	for (const auto &tok: util::tokenize(spec, ','))
+	{
+		bool found(false);
+		for (const auto &p: model.profiles)
+		{
+			if (tok == p.name)
+			{
+				list.insert(list.end(), p.regions.begin(), p.regions.end());
+				found = true;
+				break;
+			}
+		}
+
+		if (found)
+			continue;
+
+		region::TList range;
+		if (!region::parse(tok, range))
+		{
+			loge("Unknown profile or invalid range: %s", tok.c_str());
+			return false;
+		}
+
+		list.insert(list.end(), range.begin(), range.end());
+	}
+
+	region::align(list, config::PACKET_SIZE);
+	list = region::intersect(list, model.readable);
+	if (list.empty())
+	{
+		loge("No readable memory selected");
+		return false;
+	}
+
+	return true;
+}
+
+bool models::checkRegions(const std::string &spec, std::string &invalid)
+{
+	for (const auto &tok: util::tokenize(spec, ','))
+	{
+		bool found(false);
+		for (const auto &m: MODELS)
+		{
+			for (const auto &p: m.profiles)
+				found = found || tok == p.name;
+		}
+
+		region::TList range;
+		if (!found && !region::parse(tok, range))
+		{
+			invalid = tok;
+			return false;
+		}
+	}
+
+	return true;
+}
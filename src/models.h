@@ -0,0 +1,81 @@
+/**
+ * \brief	Radio model capabilities
+ * \author	Circuit Chaos
+ * \date	2020-04-08
+ *
+ * Everything that can differ between radios speaking this protocol is
+ * described here, keyed on radio name from the handshake ID. Unknown
+ * radios get parameters of CRT Micron UV, as all known clones share
+ * its memory layout.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <inttypes.h>
+#include "region.h"
+
+namespace models
+{
+	// named set of regions, selectable with omi read -s
+	struct SProfile
+	{
+		const char *name;
+		region::TList regions;
+	};
+
+	struct SModel
+	{
+		// name from radio ID (see protocol::SRadioId), NULL for
+		// default entry
+		const char *name;
+		const char *descr;
+
+		// size of memory image (.omi file data)
+		uint16_t memorySize;
+
+		// regions read by omi read and written by omi write; must be
+		// normalized and aligned to config::PACKET_SIZE
+		region::TList readable;
+		region::TList writable;
+
+		// parts of writable regions known to hold configuration; omi
+		// write skips the rest unless -a is given
+		region::TList writeMask;
+
+		std::vector<SProfile> profiles;
+
+		// regions read first, so data needed by export and import is
+		// available early; must be normalized and aligned
+		region::TList priority;
+
+		// radio-specific data (model name, firmware version and date,
+		// what looks like per-unit tuning), read before resuming a read,
+		// so a journal left by another radio isn't used; must be
+		// readable and aligned
+		region::TList fingerprint;
+
+		// largest packet size tried when probing
+		uint8_t maxPacketSize;
+
+		// inter-frame gap used until it's learned, in microseconds
+		unsigned defaultGap;
+
+		// channel layout is described in impexp.h
+		unsigned numChannels;
+	};
+
+	// model is the raw radio ID, as stored in .omi files
+	const SModel &find(const std::string &model);
+
+	// spec is a comma-separated list of profile names and start-end
+	// ranges (see region::parse); result is aligned to packet size and
+	// limited to readable regions
+	bool selectRegions(const SModel &model, const std::string &spec, region::TList &list);
+
+	// checks spec syntax before the radio model is known: every item must
+	// be a profile of some model or a valid range; invalid is set to the
+	// first one which isn't
+	bool checkRegions(const std::string &spec, std::string &invalid);
+}
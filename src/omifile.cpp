@@ -11,6 +11,7 @@
 #include "throw.h"
 #include "util.h"
 #include "log.h"
+#include "config.h"
 
 #define xmin(a, b) ((a) < (b) ? (a) : (b))
 
@@ -70,7 +71,7 @@ bool COmiFile::read(const std::string &path)
 		return false;
 	}
 
-	if (hdr.version != 1)
+	if (hdr.version < 1 || hdr.version > 3)
 	{
 		loge("%s: invalid version; maybe written with newer utility?", path.c_str());
 		return false;
@@ -87,13 +88,36 @@ bool COmiFile::read(const std::string &path)
 	}
 
 	m_offset = hdr.offset;
-	m_data.resize(hdr.size);
+	m_data.assign(hdr.size, 0xff);
+	m_regions.clear();
+	m_dirty.clear();
 	m_model.assign((const char *) hdr.model, xmin(hdr.modelSize, sizeof(hdr.model)));
 
-	if (!r(&m_data[0], m_data.size()))
+	if (hdr.version >= 2)
 	{
-		loge("%s: data read error", path.c_str());
+		if (!readTable(r, path, calcCrc, m_regions))
+			return false;
+
+		if (m_regions.empty())
+		{
+			loge("%s: file does not contain any regions", path.c_str());
+			return false;
+		}
+	}
+
+	if (hdr.version >= 3 && !readTable(r, path, calcCrc, m_dirty))
 		return false;
+
+	for (const auto &reg: getRegions())
+	{
+		uint8_t *p(&m_data[reg.offset - m_offset]);
+		if (!r(p, reg.size))
+		{
+			loge("%s: data read error", path.c_str());
+			return false;
+		}
+
+		calcCrc = util::crc32(calcCrc, p, reg.size);
 	}
 
 	uint8_t testByte;
@@ -103,7 +127,6 @@ bool COmiFile::read(const std::string &path)
 		return false;
 	}
 
-	calcCrc = util::crc32(calcCrc, &m_data[0], m_data.size());
 	if (calcCrc != hdrCrc)
 	{
 		loge("%s: CRC32 mismatch (calculated 0x%08x, read 0x%08x)", path.c_str(), calcCrc, hdrCrc);
@@ -115,10 +138,18 @@ bool COmiFile::read(const std::string &path)
 
 bool COmiFile::write(const std::string &path) const
 {
+	xassert(!m_data.empty(), "Empty data");
+
+	const bool complete(isComplete());
+	const region::TList regions(getRegions());
+
+	for (const auto &reg: m_dirty)
+		xassert(reg.offset >= m_offset && reg.offset + reg.size <= m_offset + m_data.size(), "Dirty region outside of data");
+
 	SHdr hdr;
 
 	hdr.magic = MAGIC;
-	hdr.version = 1;
+	hdr.version = !m_dirty.empty() ? 3 : complete ? 1 : 2;
 	hdr.offset = m_offset;
 	hdr.size = m_data.size();
 	hdr.modelSize = m_model.size();
@@ -131,8 +162,21 @@ bool COmiFile::write(const std::string &path) const
 
 	uint32_t crc(util::crc32(0, &hdr, sizeof(hdr)));
 
-	xassert(!m_data.empty(), "Empty data");
-	crc = util::crc32(crc, &m_data[0], m_data.size());
+	std::vector<uint8_t> tables;
+	if (hdr.version >= 2)
+		encodeTable(regions, tables);
+
+	if (hdr.version >= 3)
+		encodeTable(m_dirty, tables);
+
+	if (!tables.empty())
+		crc = util::crc32(crc, &tables[0], tables.size());
+
+	for (const auto &reg: regions)
+	{
+		xassert(reg.offset >= m_offset && reg.offset + reg.size <= m_offset + m_data.size(), "Region outside of data");
+		crc = util::crc32(crc, &m_data[reg.offset - m_offset], reg.size);
+	}
 
 	hdr.crc32 = crc;
 	hdr.fromHost();
@@ -150,12 +194,21 @@ bool COmiFile::write(const std::string &path) const
 		return false;
 	}
 
-	if (!w(&m_data[0], m_data.size()))
+	if (!tables.empty() && !w(&tables[0], tables.size()))
 	{
-		loge("%s: data write error", path.c_str());
+		loge("%s: region table write error", path.c_str());
 		return false;
 	}
 
+	for (const auto &reg: regions)
+	{
+		if (!w(&m_data[reg.offset - m_offset], reg.size))
+		{
+			loge("%s: data write error", path.c_str());
+			return false;
+		}
+	}
+
 	if (!w.close())
 	{
 		loge("%s: close error", path.c_str());
@@ -165,6 +218,61 @@ bool COmiFile::write(const std::string &path) const
 	return true;
 }
 
+bool COmiFile::readTable(CRawReader &r, const std::string &path, uint32_t &crc, region::TList &list) const
+{
+	uint16_t num;
+	if (!r(&num, sizeof(num)))
+	{
+		loge("%s: region table read error", path.c_str());
+		return false;
+	}
+
+	crc = util::crc32(crc, &num, sizeof(num));
+	num = be16toh(num);
+
+	unsigned prevEnd(m_offset);
+	for (unsigned i(0); i < num; ++i)
+	{
+		SRegionHdr rh;
+		if (!r(&rh, sizeof(rh)))
+		{
+			loge("%s: region table read error", path.c_str());
+			return false;
+		}
+
+		crc = util::crc32(crc, &rh, sizeof(rh));
+
+		const region::SRegion reg { be16toh(rh.offset), be16toh(rh.size) };
+		logd("Region: 0x%04x-0x%04x", reg.offset, reg.offset + reg.size);
+
+		if (reg.size == 0 || reg.offset < prevEnd || reg.offset + reg.size > m_offset + m_data.size())
+		{
+			loge("%s: invalid region table", path.c_str());
+			return false;
+		}
+
+		prevEnd = reg.offset + reg.size;
+		list.push_back(reg);
+	}
+
+	region::normalize(list);
+	return true;
+}
+
+void COmiFile::encodeTable(const region::TList &list, std::vector<uint8_t> &out)
+{
+	const uint16_t num(htobe16(list.size()));
+	const uint8_t *p((const uint8_t *) &num);
+	out.insert(out.end(), p, p + sizeof(num));
+
+	for (const auto &reg: list)
+	{
+		const SRegionHdr rh { htobe16(reg.offset), htobe16(reg.size) };
+		p = (const uint8_t *) &rh;
+		out.insert(out.end(), p, p + sizeof(rh));
+	}
+}
+
 uint16_t COmiFile::getOffset() const
 {
 	return m_offset;
@@ -196,3 +304,50 @@ void COmiFile::setModel(const std::string &model)
 {
 	m_model = model;
 }
+
+region::TList COmiFile::getRegions() const
+{
+	if (m_regions.empty())
+		return region::TList { region::SRegion { m_offset, uint16_t(m_data.size()) } };
+
+	return m_regions;
+}
+
+void COmiFile::setRegions(const region::TList &regions)
+{
+	m_regions = regions;
+	region::normalize(m_regions);
+}
+
+bool COmiFile::isComplete() const
+{
+	return region::contains(getRegions(), m_offset, m_data.size());
+}
+
+const region::TList &COmiFile::getDirty() const
+{
+	return m_dirty;
+}
+
+void COmiFile::markDirty(uint16_t offset, uint16_t size)
+{
+	m_dirty.push_back(region::SRegion { offset, size });
+	region::align(m_dirty, config::PACKET_SIZE);
+}
+
+void COmiFile::markChanged(const std::vector<uint8_t> &orig)
+{
+	xassert(orig.size() == m_data.size(), "Data size changed");
+
+	for (size_t ofs(0); ofs < m_data.size(); ofs += config::PACKET_SIZE)
+	{
+		const size_t len(xmin(config::PACKET_SIZE, m_data.size() - ofs));
+		if (memcmp(&m_data[ofs], &orig[ofs], len))
+			markDirty(m_offset + ofs, len);
+	}
+}
+
+void COmiFile::clearDirty()
+{
+	m_dirty.clear();
+}
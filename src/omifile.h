@@ -9,6 +9,9 @@
 #include <string>
 #include <vector>
 #include <inttypes.h>
+#include "region.h"
+
+class CRawReader;
 
 class COmiFile
 {
@@ -29,6 +32,22 @@ public:
 	const std::string &getModel() const;
 	void setModel(const std::string &model);
 
+	// memory addresses of data actually present; unless set, it's all
+	// the data. files with only some regions present (sparse) are
+	// written as version 2; data outside of regions is 0xff
+	region::TList getRegions() const;
+	void setRegions(const region::TList &regions);
+	bool isComplete() const;
+
+	// blocks changed since data was read from the radio, aligned to
+	// config::PACKET_SIZE; editors mark them, so omi write can upload
+	// only these. markChanged() marks blocks which differ from orig
+	// (data before editing)
+	const region::TList &getDirty() const;
+	void markDirty(uint16_t offset, uint16_t size);
+	void markChanged(const std::vector<uint8_t> &orig);
+	void clearDirty();
+
 private:
 	static const uint32_t MAGIC = 0x4f4d4921;	// "OMI!"
 
@@ -39,13 +58,20 @@ private:
 		// magic, always OMI!
 		uint32_t magic;
 
-		// file version, currently only 1 is supported
+		// file version:
+		// - 1: all data is present
+		// - 2: header is followed by region table (uint16_t
+		//   number of regions, then SRegionHdr for each) and
+		//   data of these regions only
+		// - 3: like 2, but region table is followed by table of
+		//   dirty regions (see getDirty()), in the same format
 		uint16_t version;
 
 		// first memory address that has been read
 		uint16_t offset;
 
-		// number of bytes that are present
+		// number of bytes that are present (in version 2, size of
+		// the whole image that regions are part of)
 		uint16_t size;
 
 		// radio model size (actual, not present)
@@ -70,7 +96,20 @@ private:
 		static uint32_t crcToHost(uint32_t crc);
 	} __attribute__((packed));
 
+	// region table entry; memory address and size, BE
+	struct SRegionHdr
+	{
+		uint16_t offset;
+		uint16_t size;
+	} __attribute__((packed));
+
+	// reads region table (see SHdr::version) and updates crc
+	bool readTable(CRawReader &r, const std::string &path, uint32_t &crc, region::TList &list) const;
+	static void encodeTable(const region::TList &list, std::vector<uint8_t> &out);
+
 	uint16_t m_offset;
+	region::TList m_regions;
+	region::TList m_dirty;
 	std::string m_model;
 	std::vector<uint8_t> m_data;
 };
@@ -0,0 +1,135 @@
+/**
+ * \brief	Adaptive inter-frame pacing
+ * \author	Circuit Chaos
+ * \date	2020-04-03
+ */
+
+#include <unistd.h>
+#include "pacer.h"
+#include "config.h"
+#include "util.h"
+#include "log.h"
+
+CPacer::CPacer():
+	m_gap(config::PACE_DEFAULT_GAP),
+	m_floor(0),
+	m_turnaround(0),
+	m_maxTurnaround(0),
+	m_lastRx(0),
+	m_backedOff(false),
+	m_goodGap(m_gap),
+	m_goodFloor(0),
+	m_goodMaxTurnaround(0)
+{
+}
+
+unsigned CPacer::getGap() const
+{
+	return m_gap;
+}
+
+void CPacer::setGap(unsigned gap)
+{
+	m_gap = gap > config::PACE_MAX_GAP ? config::PACE_MAX_GAP : gap;
+	m_floor = 0;
+	logd("Inter-frame gap set to %u us", m_gap);
+}
+
+unsigned CPacer::getTurnaround() const
+{
+	return m_turnaround;
+}
+
+unsigned CPacer::getMaxTurnaround() const
+{
+	return m_maxTurnaround;
+}
+
+void CPacer::setMaxTurnaround(unsigned turnaround)
+{
+	m_maxTurnaround = turnaround > config::PACE_MAX_TURNAROUND ? config::PACE_MAX_TURNAROUND : turnaround;
+	logd("Maximum turnaround set to %u us", m_maxTurnaround);
+}
+
+void CPacer::wait() const
+{
+	const uint64_t elapsed(util::monotonicUs() - m_lastRx);
+	if (elapsed < m_gap)
+		usleep(m_gap - elapsed);
+}
+
+void CPacer::received()
+{
+	m_lastRx = util::monotonicUs();
+}
+
+void CPacer::succeeded(unsigned turnaround)
+{
+	// exponential moving average, 1/8 weight of new sample
+	m_turnaround = m_turnaround ? (m_turnaround * 7 + turnaround) / 8 : turnaround;
+
+	if (turnaround > m_maxTurnaround)
+		m_maxTurnaround = turnaround > config::PACE_MAX_TURNAROUND ? config::PACE_MAX_TURNAROUND : turnaround;
+	else if (!m_maxTurnaround)
+	{
+		// zero means unknown, so it's at least 1
+		m_maxTurnaround = 1;
+	}
+
+	// radio needs about as much time to get ready for the next frame
+	// as it needs to respond; gap moves halfway down to that, so a
+	// single fast response doesn't cause a timeout, and straight up
+	// if radio slowed down. it never goes below the floor
+	unsigned target(m_turnaround > m_floor ? m_turnaround : m_floor);
+	if (target > config::PACE_MAX_GAP)
+		target = config::PACE_MAX_GAP;
+
+	m_gap = m_gap > target ? (m_gap + target) / 2 : target;
+
+	m_goodGap = m_gap;
+	m_goodFloor = m_floor;
+	m_goodMaxTurnaround = m_maxTurnaround;
+}
+
+void CPacer::timedOut()
+{
+	if (m_maxTurnaround && m_maxTurnaround < config::PACE_MAX_TURNAROUND)
+	{
+		m_maxTurnaround = m_maxTurnaround > config::PACE_TURNAROUND_STEP ? m_maxTurnaround * 2 : m_maxTurnaround + config::PACE_TURNAROUND_STEP;
+		if (m_maxTurnaround > config::PACE_MAX_TURNAROUND)
+			m_maxTurnaround = config::PACE_MAX_TURNAROUND;
+
+		m_backedOff = true;
+		logi("Radio timeout, increasing turnaround allowance to %u us", m_maxTurnaround);
+	}
+
+	m_floor = m_gap + config::PACE_STEP;
+	if (m_floor > config::PACE_MAX_GAP)
+		m_floor = config::PACE_MAX_GAP;
+
+	if (m_gap >= config::PACE_MAX_GAP)
+		return;
+
+	m_gap = m_gap * 2 + config::PACE_STEP;
+	if (m_gap > config::PACE_MAX_GAP)
+		m_gap = config::PACE_MAX_GAP;
+
+	m_backedOff = true;
+	logi("Radio timeout, increasing inter-frame gap to %u us", m_gap);
+}
+
+bool CPacer::backedOff()
+{
+	const bool rs(m_backedOff);
+	m_backedOff = false;
+	return rs;
+}
+
+void CPacer::rollback()
+{
+	m_gap = m_goodGap;
+	m_floor = m_goodFloor;
+	m_maxTurnaround = m_goodMaxTurnaround;
+	m_backedOff = false;
+	logd("Pacing rolled back to gap %u us, turnaround allowance %u us", m_gap, m_maxTurnaround);
+}
@@ -0,0 +1,69 @@
+/**
+ * \brief	Adaptive inter-frame pacing
+ * \author	Circuit Chaos
+ * \date	2020-04-03
+ *
+ * Some radios don't respond if the next frame is sent too early after
+ * their previous response. Instead of a fixed delay, gap between last
+ * received byte and next frame follows radio turnaround (time between
+ * end of request and start of response), measured after each
+ * successful frame, and is increased after a timeout. Gap which
+ * resulted in timeout becomes the lower bound, so it converges on
+ * minimum safe value.
+ *
+ * All times are in microseconds.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+
+class CPacer
+{
+public:
+	CPacer();
+
+	unsigned getGap() const;
+	void setGap(unsigned gap);
+	unsigned getTurnaround() const;
+
+	// largest turnaround seen, zero if not known yet; increased after
+	// every timeout, as it's used to compute time budgets
+	unsigned getMaxTurnaround() const;
+	void setMaxTurnaround(unsigned turnaround);
+
+	// sleeps for the rest of the gap, if needed; called before
+	// every frame is sent
+	void wait() const;
+
+	// called after data has been received
+	void received();
+
+	// called after whole frame has been exchanged successfully;
+	// turnaround is measured by the caller
+	void succeeded(unsigned turnaround);
+
+	// called when radio did not respond in time
+	void timedOut();
+
+	// returns true (once) if gap has been increased since last call,
+	// so the failed operation is worth retrying
+	bool backedOff();
+
+	// restores gap and turnaround allowance from the last successful
+	// frame; used when timeouts turned out not to be caused by pacing
+	void rollback();
+
+private:
+	unsigned m_gap;
+	unsigned m_floor;
+	unsigned m_turnaround;
+	unsigned m_maxTurnaround;
+	uint64_t m_lastRx;
+	bool m_backedOff;
+
+	// state after last successful frame
+	unsigned m_goodGap;
+	unsigned m_goodFloor;
+	unsigned m_goodMaxTurnaround;
+};
@@ -0,0 +1,56 @@
+/**
+ * \brief	Adaptive packet size
+ * \author	Circuit Chaos
+ * \date	2020-04-02
+ */
+
+#include "pktsize.h"
+#include "config.h"
+#include "throw.h"
+#include "log.h"
+
+CPacketSize::CPacketSize(uint8_t max): m_max(max), m_cur(max), m_lastFailed(0), m_streak(0)
+{
+	xassert(max >= config::PACKET_SIZE && max % config::PACKET_SIZE == 0, "Invalid packet size %u", max);
+}
+
+uint8_t CPacketSize::get() const
+{
+	return m_cur;
+}
+
+uint8_t CPacketSize::getMax() const
+{
+	return m_max;
+}
+
+bool CPacketSize::failed()
+{
+	m_streak = 0;
+	if (m_cur <= config::PACKET_SIZE)
+		return false;
+
+	if (m_cur == m_lastFailed)
+	{
+		logn("Packet size %u failed twice, not using it anymore", m_cur);
+		m_max = m_cur / 2;
+	}
+
+	m_lastFailed = m_cur;
+	m_cur /= 2;
+	logi("Decreasing packet size to %u", m_cur);
+	return true;
+}
+
+void CPacketSize::succeeded()
+{
+	if (m_cur >= m_max)
+		return;
+
+	if (++m_streak < config::PKT_GROW_AFTER)
+		return;
+
+	m_streak = 0;
+	m_cur *= 2;
+	logi("Increasing packet size to %u", m_cur);
+}
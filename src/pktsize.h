@@ -0,0 +1,33 @@
+/**
+ * \brief	Adaptive packet size
+ * \author	Circuit Chaos
+ * \date	2020-04-02
+ *
+ * Starts with the largest size accepted by the radio (as probed
+ * when the link is set up), halves it on every failure and doubles it
+ * back after a number of consecutive successes. Size that failed
+ * twice is no longer tried in this session.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+
+class CPacketSize
+{
+public:
+	CPacketSize(uint8_t max);
+
+	uint8_t get() const;
+	uint8_t getMax() const;
+
+	// return false if size cannot be decreased anymore
+	bool failed();
+	void succeeded();
+
+private:
+	uint8_t m_max;
+	uint8_t m_cur;
+	uint8_t m_lastFailed;
+	unsigned m_streak;
+};
@@ -9,16 +9,64 @@
 #include <fcntl.h>
 #include <termios.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#include <libgen.h>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <poll.h>
+#include <csignal>
 #include "port.h"
 #include "log.h"
 #include "fd.h"
 #include "throw.h"
+#include "config.h"
+#include "util.h"
 
-CPort::CPort(const std::string &devpath, unsigned timeout): m_timeout(timeout)
+// returns like poll(), timeout in milliseconds
+static int pollFd(int fd, short events, unsigned timeout)
+{
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = events;
+	pfd.revents = 0;
+
+	return poll(&pfd, 1, timeout);
+}
+
+static bool readSysfs(const std::string &path, int &value)
+{
+	FILE *fp(fopen(path.c_str(), "r"));
+	if (!fp)
+		return false;
+
+	const bool rs(fscanf(fp, "%d", &value) == 1);
+	fclose(fp);
+	return rs;
+}
+
+static bool writeSysfs(const std::string &path, int value)
+{
+	FILE *fp(fopen(path.c_str(), "w"));
+	if (!fp)
+		return false;
+
+	const bool rs(fprintf(fp, "%d", value) > 0);
+	return fclose(fp) == 0 && rs;
+}
+
+static const int RESTORE_SIGNALS[] = { SIGINT, SIGTERM, SIGHUP };
+
+CPort *CPort::s_lowLatency(NULL);
+
+CPort::CPort(const std::string &devpath, unsigned timeout): m_path(devpath), m_timeout(timeout), m_quiet(false), m_echo(true), m_serialFlags(-1), m_latencyTimer(-1), m_rxHead(0), m_rxTail(0)
 {
 	logd("Opening port %s", devpath.c_str());
 
-	CFd fd(open(devpath.c_str(), O_RDWR | O_NOCTTY));
+	CFd fd(open(devpath.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK));
 	if (fd == -1)
 	{
 		loge("Cannot open device: %s: %m", devpath.c_str());
@@ -70,6 +118,17 @@ CPort::~CPort()
 
 	logd("Draining port");
 	tcdrain(m_fd);
+
+	if (s_lowLatency == this)
+	{
+		for (const auto sig: RESTORE_SIGNALS)
+			signal(sig, SIG_DFL);
+
+		s_lowLatency = NULL;
+	}
+
+	if (!restoreLowLatency())
+		logn("Cannot restore serial flags or latency timer of the port");
 }
 
 bool CPort::isOpen() const
@@ -77,85 +136,197 @@ bool CPort::isOpen() const
 	return m_fd != -1;
 }
 
+const std::string &CPort::getPath() const
+{
+	return m_path;
+}
+
 bool CPort::read(void *data, size_t size)
 {
-	char *p((char *) data);
-	unsigned rem(size);
+	return read(data, size, m_timeout);
+}
 
-	while (rem)
+bool CPort::read(void *data, size_t size, unsigned timeout)
+{
+	const uint8_t *p(peek(size, timeout));
+	if (!p)
+		return false;
+
+	memcpy(data, p, size);
+	consume(size);
+	return true;
+}
+
+const uint8_t *CPort::peek(size_t size, unsigned timeout)
+{
+	xassert(size <= sizeof(m_rx), "Read of %zu bytes exceeds receive buffer", size);
+
+	const uint64_t deadline(util::monotonicUs() + (uint64_t) timeout * 1000);
+	while (m_rxTail - m_rxHead < size)
 	{
-		fd_set rfd;
+		if (!fill(deadline, timeout))
+		{
+			dumpPending();
+			return NULL;
+		}
+	}
 
-		FD_ZERO(&rfd);
-		FD_SET(m_fd, &rfd);
+	return &m_rx[m_rxHead];
+}
+
+void CPort::consume(size_t size)
+{
+	xassert(size <= m_rxTail - m_rxHead, "Consuming %zu bytes, but only %zu are buffered", size, m_rxTail - m_rxHead);
 
-		struct timeval tv;
+	logdump("<<", &m_rx[m_rxHead], size);
+	m_rxHead += size;
+}
+
+bool CPort::expect(const void *data, size_t size, unsigned timeout)
+{
+	xassert(size <= sizeof(m_rx), "Read of %zu bytes exceeds receive buffer", size);
 
-		tv.tv_sec = m_timeout;
-		tv.tv_usec = 0;
+	const uint8_t *p((const uint8_t *) data);
+	const uint64_t deadline(util::monotonicUs() + (uint64_t) timeout * 1000);
+	size_t matched(0);
 
-		int selrs(select(m_fd + 1, &rfd, 0, 0, &tv));
-		if (selrs == -1)
+	for (;;)
+	{
+		// offsets are relative to head, as fill() may move data
+		const size_t avail(std::min(m_rxTail - m_rxHead, size));
+		if (memcmp(&m_rx[m_rxHead + matched], &p[matched], avail - matched))
 		{
-			if (errno == EAGAIN || errno == EINTR)
-				continue;
+			logd("Received data differs from expected");
+			logdump("??", p, size);
+			dumpPending();
+			return false;
+		}
+
+		matched = avail;
+		if (matched == size)
+			break;
 
-			loge("Port select error: %m");
+		if (!fill(deadline, timeout))
+		{
+			dumpPending();
 			return false;
 		}
+	}
+
+	consume(size);
+	return true;
+}
+
+void CPort::dumpPending() const
+{
+	if (m_rxTail == m_rxHead)
+		return;
+
+	logd("Dumping data read so far");
+	logdump("<<", &m_rx[m_rxHead], m_rxTail - m_rxHead);
+}
+
+bool CPort::readUntil(uint8_t term, std::string &data, size_t maxSize)
+{
+	const uint64_t deadline(util::monotonicUs() + (uint64_t) m_timeout * 1000);
+	size_t scanned(0);
+	for (;;)
+	{
+		const uint8_t *p((const uint8_t *) memchr(&m_rx[m_rxHead + scanned], term, m_rxTail - m_rxHead - scanned));
+		if (p)
+		{
+			const size_t size(p - &m_rx[m_rxHead]);
+			data.assign((const char *) &m_rx[m_rxHead], size);
+			logdump("<<", &m_rx[m_rxHead], size + 1);
+			m_rxHead += size + 1;
+			return true;
+		}
 
-		if (selrs == 0)
+		scanned = m_rxTail - m_rxHead;
+		if (scanned > maxSize)
 		{
-			loge("Radio not responding");
-			if (rem != size)
-			{
-				logd("Dumping data read so far");
-				logdump("<<", data, size - rem);
-			}
+			loge("Too much data received without terminator");
+			logdump("<<", &m_rx[m_rxHead], scanned);
 			return false;
 		}
 
-		const int rs(::read(m_fd, p, rem));
+		if (!fill(deadline, m_timeout))
+		{
+			dumpPending();
+			return false;
+		}
+	}
+}
+
+bool CPort::fill(uint64_t deadline, unsigned timeout)
+{
+	// receive buffer is kept linear, so frames can be accessed in place
+	if (m_rxHead)
+	{
+		memmove(m_rx, &m_rx[m_rxHead], m_rxTail - m_rxHead);
+		m_rxTail -= m_rxHead;
+		m_rxHead = 0;
+	}
+
+	xassert(m_rxTail < sizeof(m_rx), "Receive buffer full");
+
+	for (;;)
+	{
+		// port is non-blocking, so try to read first; if data is
+		// already there (like echo), it saves a poll() call
+		const int rs(::read(m_fd, &m_rx[m_rxTail], sizeof(m_rx) - m_rxTail));
+		if (rs > 0)
+		{
+			m_rxTail += rs;
+			m_pacer.received();
+			return true;
+		}
 
 		if (!rs)
 		{
 			loge("EOF reading from device (radio disconnected?)");
-			if (rem != size)
-			{
-				logd("Dumping data read so far");
-				logdump("<<", data, size - rem);
-			}
 			return false;
 		}
 
-		if (rs == -1)
+		if (errno == EINTR)
+			continue;
+
+		if (errno != EAGAIN)
+		{
+			loge("Port read error: %m");
+			return false;
+		}
+
+		const uint64_t now(util::monotonicUs());
+		const int pollrs(now < deadline ? pollFd(m_fd, POLLIN, (deadline - now + 999) / 1000) : 0);
+		if (pollrs == -1)
 		{
 			if (errno == EAGAIN || errno == EINTR)
 				continue;
 
-			loge("Port read error: %m");
-			if (rem != size)
+			loge("Port poll error: %m");
+			return false;
+		}
+
+		if (pollrs == 0)
+		{
+			if (m_quiet)
+				logd("Radio not responding (%u ms)", timeout);
+			else
 			{
-				logd("Dumping data read so far");
-				logdump("<<", data, size - rem);
+				loge("Radio not responding (%u ms)", timeout);
+				m_pacer.timedOut();
 			}
 			return false;
 		}
-
-		xassert((unsigned) rs <= rem, "read() on port returned nonsense");
-
-		p += rs;
-		rem -= rs;
 	}
-
-	logdump("<<", data, size);
-	return true;
 }
 
 bool CPort::write(const void *data, size_t size)
 {
-	// it seems to be needed as without it I'm getting random "radio not responding" errors...
-	usleep(5000);
+	// some radios don't respond to frames sent too early after their
+	// previous response; gap is learned by the pacer
+	m_pacer.wait();
 
 	logdump(">>", data, size);
 
@@ -168,8 +339,18 @@ bool CPort::write(const void *data, size_t size)
 
 		if (rs == -1)
 		{
-			if (errno == EAGAIN || errno == EINTR)
+			if (errno == EINTR)
+				continue;
+
+			if (errno == EAGAIN)
+			{
+				if (pollFd(m_fd, POLLOUT, m_timeout) == 0)
+				{
+					loge("Port write timeout");
+					return false;
+				}
 				continue;
+			}
 
 			loge("Port write() error: %m");
 			return false;
@@ -185,3 +366,205 @@ bool CPort::write(const void *data, size_t size)
 
 	return true;
 }
+
+void CPort::flush()
+{
+	if (m_rxTail != m_rxHead)
+	{
+		logd("Discarding %zu buffered byte(s) of input", m_rxTail - m_rxHead);
+		logdump("<<", &m_rx[m_rxHead], m_rxTail - m_rxHead);
+	}
+
+	m_rxHead = m_rxTail = 0;
+
+	for (;;)
+	{
+		const int pollrs(pollFd(m_fd, POLLIN, config::QUIET_TIME));
+		if (pollrs == -1 && (errno == EAGAIN || errno == EINTR))
+			continue;
+
+		if (pollrs != 1)
+			break;
+
+		char buf[64];
+		const int rs(::read(m_fd, buf, sizeof(buf)));
+		if (rs <= 0)
+			break;
+
+		logd("Discarding %d byte(s) of input", rs);
+		logdump("<<", buf, rs);
+	}
+
+	if (tcflush(m_fd, TCIFLUSH) == -1)
+		logn("Port tcflush error: %m");
+
+	m_pacer.received();
+}
+
+bool CPort::setLowLatency()
+{
+	bool rs(false);
+
+	struct serial_struct ss;
+	if (ioctl(m_fd, TIOCGSERIAL, &ss) == -1)
+		logn("Cannot get serial flags (not a serial port?): %m");
+	else if (ss.flags & ASYNC_LOW_LATENCY)
+	{
+		logd("Low latency flag already set");
+		rs = true;
+	}
+	else
+	{
+		const int flags(ss.flags);
+		ss.flags |= ASYNC_LOW_LATENCY;
+		if (ioctl(m_fd, TIOCSSERIAL, &ss) == -1)
+			logn("Cannot set low latency flag: %m");
+		else
+		{
+			logd("Low latency flag set");
+			m_serialFlags = flags;
+			catchSignals();
+			rs = true;
+		}
+	}
+
+	// FTDI adapters buffer data for latency_timer milliseconds (16 by
+	// default) before sending it to the host
+	char *real(realpath(m_path.c_str(), NULL));
+	if (!real)
+		return rs;
+
+	const std::string path(std::string("/sys/bus/usb-serial/devices/") + basename(real) + "/latency_timer");
+	free(real);
+
+	int timer;
+	if (!readSysfs(path, timer))
+	{
+		logd("No latency timer at %s, probably not an FTDI adapter", path.c_str());
+		return rs;
+	}
+
+	if (timer <= (int) config::FTDI_LATENCY_TIMER)
+	{
+		logd("Latency timer already set to %d ms", timer);
+		return true;
+	}
+
+	if (!writeSysfs(path, config::FTDI_LATENCY_TIMER))
+	{
+		logn("Cannot lower latency timer at %s (insufficient permissions?)", path.c_str());
+		return rs;
+	}
+
+	logd("Latency timer lowered from %d to %u ms", timer, config::FTDI_LATENCY_TIMER);
+	m_latencyTimer = timer;
+	m_latencyTimerPath = path;
+	m_latencyTimerText = util::format("%d", timer);
+	catchSignals();
+	return true;
+}
+
+void CPort::catchSignals()
+{
+	if (s_lowLatency == this)
+		return;
+
+	xassert(!s_lowLatency, "Low latency mode set on two ports");
+	s_lowLatency = this;
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = onSignal;
+	sigemptyset(&sa.sa_mask);
+	for (const auto sig: RESTORE_SIGNALS)
+		sigaction(sig, &sa, NULL);
+}
+
+bool CPort::restoreLowLatency()
+{
+	bool rs(true);
+	if (m_serialFlags != -1)
+	{
+		struct serial_struct ss;
+		if (ioctl(m_fd, TIOCGSERIAL, &ss) == -1)
+			rs = false;
+		else
+		{
+			ss.flags = m_serialFlags;
+			rs = ioctl(m_fd, TIOCSSERIAL, &ss) != -1;
+		}
+
+		m_serialFlags = -1;
+	}
+
+	if (m_latencyTimer != -1)
+	{
+		const int fd(open(m_latencyTimerPath.c_str(), O_WRONLY));
+		if (fd == -1 || ::write(fd, m_latencyTimerText.data(), m_latencyTimerText.size()) != (ssize_t) m_latencyTimerText.size())
+			rs = false;
+
+		if (fd != -1 && close(fd) != 0)
+			rs = false;
+
+		m_latencyTimer = -1;
+	}
+
+	return rs;
+}
+
+// restores port settings and terminates with the same signal
+void CPort::onSignal(int sig)
+{
+	if (s_lowLatency)
+		s_lowLatency->restoreLowLatency();
+
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+bool CPort::isLowLatency() const
+{
+	return m_serialFlags != -1 || m_latencyTimer != -1;
+}
+
+void CPort::setEcho(bool echo)
+{
+	m_echo = echo;
+}
+
+bool CPort::hasEcho() const
+{
+	return m_echo;
+}
+
+unsigned CPort::echoBudget(size_t size)
+{
+	// echo is produced by the cable, so there's no turnaround
+	return (transferTime(size) + 999) / 1000 + config::BUDGET_MARGIN;
+}
+
+unsigned CPort::responseBudget(size_t size)
+{
+	// until first response is measured, turnaround is unknown
+	const unsigned turnaround(m_pacer.getMaxTurnaround());
+	if (!turnaround)
+		return m_timeout;
+
+	const unsigned budget((transferTime(size) + 2 * turnaround + 999) / 1000 + config::BUDGET_MARGIN);
+	return budget < m_timeout ? budget : m_timeout;
+}
+
+void CPort::setQuiet(bool quiet)
+{
+	m_quiet = quiet;
+}
+
+CPacer &CPort::getPacer()
+{
+	return m_pacer;
+}
+
+unsigned CPort::transferTime(size_t size)
+{
+	return (uint64_t) size * config::BITS_PER_BYTE * 1000000 / config::PORT_BAUD;
+}
@@ -11,18 +11,103 @@
 #include <string>
 #include <inttypes.h>
 #include "fd.h"
+#include "pacer.h"
+#include "config.h"
 
 class CPort
 {
 public:
+	// timeout is in milliseconds; it's used for operations of unknown
+	// duration (like handshake), others should use budgets below
 	CPort(const std::string &devpath, unsigned timeout);
 	~CPort();
 
 	bool isOpen() const;
+	const std::string &getPath() const;
+
+	// timeout (in milliseconds) counts from the call, not from the
+	// last byte received
 	bool read(void *data, size_t size);
+	bool read(void *data, size_t size, unsigned timeout);
+
+	// waits until size bytes are received and returns pointer to them
+	// in the receive buffer (or NULL on error); consume() marks them as
+	// read, but pointer stays valid until next read from the port
+	const uint8_t *peek(size_t size, unsigned timeout);
+	void consume(size_t size);
+
+	// receives size bytes and compares them with data as they arrive;
+	// fails as soon as they differ. on success, bytes are consumed
+	bool expect(const void *data, size_t size, unsigned timeout);
+
+	// reads until term is received (it's not stored in data)
+	bool readUntil(uint8_t term, std::string &data, size_t maxSize);
 	bool write(const void *data, size_t size);
 
+	// waits until line is quiet and discards all pending input
+	void flush();
+
+	// sets ASYNC_LOW_LATENCY on the port and lowers latency timer of
+	// FTDI adapters; original settings are restored on close, and if
+	// the program is terminated by SIGINT, SIGTERM or SIGHUP. returns
+	// false if nothing could be set (not an error, port still works)
+	bool setLowLatency();
+	bool isLowLatency() const;
+
+	// whether the cable echoes sent data back (default: yes); echo
+	// is read and verified by protocol layer
+	void setEcho(bool echo);
+	bool hasEcho() const;
+
+	// time budgets (in milliseconds) for reading echo of sent data and
+	// for reading radio response; computed from transfer time and
+	// radio turnaround learned by the pacer
+	unsigned echoBudget(size_t size);
+	unsigned responseBudget(size_t size);
+
+	// in quiet mode, read errors are logged only at debug level and
+	// timeouts don't affect pacing; used when errors are expected
+	// (like during probing)
+	void setQuiet(bool quiet);
+
+	CPacer &getPacer();
+
+	// time needed to transfer given number of bytes, in microseconds
+	static unsigned transferTime(size_t size);
+
 private:
+	const std::string m_path;
 	const unsigned m_timeout;
+	bool m_quiet;
+	bool m_echo;
+	CPacer m_pacer;
 	CFd m_fd;
+
+	// original settings to restore, -1 if not changed; latency timer
+	// is kept as text, so it can be written from signal handler
+	int m_serialFlags;
+	int m_latencyTimer;
+	std::string m_latencyTimerPath;
+	std::string m_latencyTimerText;
+
+	// port with low latency settings to restore on signal, if any
+	static CPort *s_lowLatency;
+
+	// data is read in chunks, as much as is available, and buffered
+	uint8_t m_rx[config::RX_BUFFER_SIZE];
+	size_t m_rxHead;
+	size_t m_rxTail;
+
+	// reads more data to receive buffer; deadline is in monotonic
+	// microseconds, timeout is only for logging
+	bool fill(uint64_t deadline, unsigned timeout);
+	void dumpPending() const;
+
+	// restores settings changed by setLowLatency(); only async-signal-
+	// safe calls are used. returns false if anything failed
+	bool restoreLowLatency();
+
+	// installs handlers restoring settings changed by setLowLatency()
+	void catchSignals();
+	static void onSignal(int sig);
 };
@@ -4,13 +4,17 @@
  * \date	2020-03-13
  */
 
-#include <vector>
+#include <array>
 #include <string>
 #include <cstring>
+#include <functional>
 #include "protocol.h"
+#include "frame.h"
 #include "throw.h"
 #include "log.h"
 #include "config.h"
+#include "linkcache.h"
+#include "util.h"
 
 static void logIssue()
 {
@@ -20,24 +24,96 @@ static void logIssue()
 	loge("  (remember to specify radio model)");
 }
 
-static bool exchange(CPort &port, const std::vector<uint8_t> &v)
+static bool exchange(CPort &port, const uint8_t *data, size_t size)
 {
-	xassert(!v.empty(), "Trying to send empty vector");
-	if (!port.write(&v[0], v.size()))
+	xassert(size != 0, "Trying to send empty frame");
+	if (!port.write(data, size))
 	{
 		loge("Port write error");
 		return false;
 	}
 
-	std::vector<uint8_t> rv;
-	rv.resize(v.size());
-	if (!port.read(&rv[0], rv.size()))
+	if (!port.hasEcho())
+		return true;
+
+	if (!port.expect(data, size, port.echoBudget(size)))
+	{
+		loge("Echo missing or did not match sent data, check cable");
+		return false;
+	}
+
+	return true;
+}
+
+// reports turnaround (time elapsed since the request minus response
+// transfer time) to pacer
+static void reportTurnaround(CPort &port, uint64_t start, size_t size)
+{
+	const uint64_t elapsed(util::monotonicUs() - start);
+	const unsigned xfer(CPort::transferTime(size));
+	port.getPacer().succeeded(elapsed > xfer ? elapsed - xfer : 0);
+}
+
+// returns (already consumed) data in the receive buffer, see
+// CPort::peek(), or NULL on error
+static const uint8_t *receive(CPort &port, size_t size)
+{
+	const uint8_t *p(port.peek(size, port.responseBudget(size)));
+	if (p)
+		port.consume(size);
+
+	return p;
+}
+
+// like receive(), but also reports turnaround to pacer
+static const uint8_t *readResponse(CPort &port, size_t size)
+{
+	const uint64_t start(util::monotonicUs());
+	const uint8_t *rsp(receive(port, size));
+	if (rsp)
+		reportTurnaround(port, start, size);
+
+	return rsp;
+}
+
+static bool exchange(CPort &port, const std::string &s)
+{
+	return exchange(port, (const uint8_t *) s.data(), s.size());
+}
+
+// detects from the response to PROGRAM if the cable echoes sent data;
+// rsp is everything received up to (but without) the ACK
+static bool detectEcho(CPort &port, const std::string &cmd, const std::string &rsp)
+{
+	static const char QX[] = "QX";
+	const size_t qxlen(sizeof(QX) - 1);
+
+	if (rsp.size() < qxlen || rsp.compare(rsp.size() - qxlen, qxlen, QX))
 	{
-		loge("Port read error during echo read");
+		loge("Radio returned unrecognized data");
+		logIssue();
 		return false;
 	}
 
-	if (v != rv)
+	const std::string echo(rsp, 0, rsp.size() - qxlen);
+	if (echo == cmd)
+	{
+		logd("Cable echoes sent data");
+		port.setEcho(true);
+	}
+	else if (echo.empty())
+	{
+		logi("Cable does not echo sent data");
+		port.setEcho(false);
+	}
+	else if (echo.size() < cmd.size() && !cmd.compare(cmd.size() - echo.size(), echo.size(), echo))
+	{
+		// adapters sometimes enable their receiver only after the
+		// first bytes were sent; further frames are echoed fully
+		logn("Cable echoed only %zu of %zu bytes of first frame, assuming full echo", echo.size(), cmd.size());
+		port.setEcho(true);
+	}
+	else
 	{
 		loge("Echo did not match sent data, check cable");
 		return false;
@@ -46,143 +122,508 @@ static bool exchange(CPort &port, const std::vector<uint8_t> &v)
 	return true;
 }
 
-static bool exchange(CPort &port, const std::string &s)
+// I<name><01>V100<00><00><ACK>
+static const size_t RADIO_ID_SIZE = 16;
+static const size_t RADIO_ID_NAME_SIZE = 7;
+
+// known radios send ID of the same size, so it's read in one go, as
+// soon as it starts arriving; other IDs are read until ACK. ACK is not
+// stored in raw
+static bool readRadioId(CPort &port, std::string &raw)
 {
-	const std::vector<uint8_t> v(s.begin(), s.end());
-	return exchange(port, v);
+	if (!port.peek(1, port.responseBudget(1)))
+		return false;
+
+	// rest of the ID follows immediately
+	port.setQuiet(true);
+	const uint8_t *p(port.peek(RADIO_ID_SIZE, port.echoBudget(RADIO_ID_SIZE)));
+	port.setQuiet(false);
+
+	if (p && p[0] == 'I' && p[RADIO_ID_SIZE - 1] == 0x06)
+	{
+		raw.assign((const char *) p, RADIO_ID_SIZE - 1);
+		port.consume(RADIO_ID_SIZE);
+		return true;
+	}
+
+	logd("Radio ID of unexpected size, reading until ACK");
+	return port.readUntil(0x06, raw, config::MAX_MODEL_SIZE);
 }
 
-bool protocol::handshake(CPort &port, std::string &model)
+bool protocol::handshake(CPort &port, SRadioId &id)
 {
-	if (!exchange(port, "PROGRAM"))
+	// echo is not known yet, so it's read together with the response
+	static const char PROGRAM[] = "PROGRAM";
+	if (!port.write(PROGRAM, sizeof(PROGRAM) - 1))
+	{
+		loge("Port write error");
+		return false;
+	}
+
+	std::string rsp;
+	if (!port.readUntil(0x06, rsp, sizeof(PROGRAM) + config::MAX_MODEL_SIZE))
+		return false;
+
+	if (!detectEcho(port, PROGRAM, rsp))
 		return false;
 
-	char qx[3];
-	if (!port.read(qx, sizeof(qx)))
+	if (!exchange(port, "\x02"))
 		return false;
 
-	if (memcmp(qx, "QX\x06", sizeof(qx)))
+	// it's used to measure radio turnaround, so time budgets can be
+	// used for further operations
+	const uint64_t start(util::monotonicUs());
+	std::string raw;
+	if (!readRadioId(port, raw))
 	{
-		loge("Radio returned unrecognized data");
+		loge("Cannot read radio ID");
 		logIssue();
 		return false;
 	}
 
-	if (!exchange(port, "\x02"))
+	reportTurnaround(port, start, raw.size() + 1);
+
+	if (!id.parse(raw))
+		logn("Unknown radio ID format");
+	else
+		logd("Radio name: %s, version: %s", util::toPrintable(id.name).c_str(), util::toPrintable(id.version).c_str());
+
+	return true;
+}
+
+bool protocol::SRadioId::parse(const std::string &s)
+{
+	raw = s;
+	name.clear();
+	version.clear();
+
+	if (s.size() != RADIO_ID_SIZE - 1 || s[0] != 'I' || s[RADIO_ID_NAME_SIZE + 1] != 0x01 || s[RADIO_ID_NAME_SIZE + 2] != 'V' ||
+		s[RADIO_ID_SIZE - 3] != 0 || s[RADIO_ID_SIZE - 2] != 0)
 		return false;
 
-	model.clear();
-	// we don't know the size, so we need to read until we receive ACK
-	// or until we run out of space
-	for (;;)
+	name = s.substr(1, RADIO_ID_NAME_SIZE);
+	name.erase(name.find_last_not_of('\0') + 1);
+	version = s.substr(RADIO_ID_NAME_SIZE + 3, RADIO_ID_SIZE - RADIO_ID_NAME_SIZE - 6);
+	return true;
+}
+
+// fits the largest burst of the largest frames
+typedef std::array<uint8_t, config::MAX_WINDOW * (config::MAX_PACKET_SIZE + CFrame<0>::OVERHEAD)> TBurstBuf;
+
+static std::string packetSizeKey(const std::string &model, bool write)
+{
+	return std::string(write ? "wpktsize:" : "pktsize:") + util::toPrintable(model);
+}
+
+// outcome of a single probe; only a rejected size is a definite answer,
+// as radio not responding might be just slow
+enum EProbe
+{
+	PROBE_OK,
+	PROBE_REJECTED,
+	PROBE_TIMEOUT,
+};
+
+// like protocol::read(), but radio not responding or responding with
+// garbage is not an error, so nothing is logged
+static EProbe probeRead(CPort &port, uint8_t size)
+{
+	const CFrame<0> frame(size);
+	uint8_t req[CFrame<0>::HDR_SIZE];
+	if (!exchange(port, req, frame.encodeRead(req, 0)))
+		return PROBE_TIMEOUT;
+
+	const uint8_t *rsp(receive(port, frame.getFrameSize()));
+	if (!rsp)
+		return PROBE_TIMEOUT;
+
+	return (frame.isResponse(rsp) && CFrame<0>::getOffset(rsp) == 0 && frame.checksumValid(rsp)) ? PROBE_OK : PROBE_REJECTED;
+}
+
+// writes back data just read from offset in one frame, so memory
+// contents don't change; radio not acknowledging it is not an error
+static EProbe probeWrite(CPort &port, uint8_t size, uint16_t offset)
+{
+	std::array<uint8_t, config::MAX_PACKET_SIZE> data;
+	for (unsigned i(0); i < size; i += config::PACKET_SIZE)
 	{
-		uint8_t ch;
-		if (!port.read(&ch, sizeof(ch)))
-			return false;
+		if (!protocol::read(port, &data[i], offset + i, config::PACKET_SIZE))
+			return PROBE_TIMEOUT;
+	}
 
-		if (ch == 0x06)
-			break;
+	const CFrame<0> frame(size);
+	std::array<uint8_t, config::MAX_PACKET_SIZE + CFrame<0>::OVERHEAD> req;
+	if (!exchange(port, &req[0], frame.encodeWrite(&req[0], offset, &data[0])))
+		return PROBE_TIMEOUT;
 
-		if (model.size() > config::MAX_MODEL_SIZE)
+	const uint8_t *ack(receive(port, 1));
+	if (!ack)
+		return PROBE_TIMEOUT;
+
+	return *ack == CFrame<0>::ACK ? PROBE_OK : PROBE_REJECTED;
+}
+
+bool protocol::cachedPacketSize(const std::string &model, uint8_t max, bool write, uint8_t &size)
+{
+	const char *what(write ? "write" : "read");
+	CLinkCache cache;
+	unsigned cached;
+	if (!cache.get(packetSizeKey(model, write), cached))
+		return false;
+
+	if (cached < config::PACKET_SIZE || cached > max || cached % config::PACKET_SIZE)
+	{
+		logn("Ignoring invalid cached %s packet size %u", what, cached);
+		return false;
+	}
+
+	logd("Using cached %s packet size %u", what, cached);
+	size = cached;
+	return true;
+}
+
+// returns size cached for model, or the largest one (up to max) for
+// which probe succeeds
+static uint8_t probePacketSize(CPort &port, const std::string &model, uint8_t max, bool write, const std::function<EProbe(uint8_t)> &probe)
+{
+	const char *what(write ? "write" : "read");
+	uint8_t cached;
+	if (protocol::cachedPacketSize(model, max, write, cached))
+		return cached;
+
+	logi("Probing for maximum %s packet size", what);
+
+	// quiet mode doesn't widen time budget on timeout, so it's widened
+	// here before retrying; pacing is restored after each size, so it
+	// isn't affected by sizes the radio doesn't accept
+	const CPacer pacer(port.getPacer());
+	bool timedOut(false);
+	unsigned size;
+
+	port.setQuiet(true);
+
+	for (size = max; size > config::PACKET_SIZE; size /= 2)
+	{
+		port.getPacer() = pacer;
+
+		EProbe rs(PROBE_TIMEOUT);
+		for (unsigned attempt(0); attempt < config::PROBE_ATTEMPTS && rs == PROBE_TIMEOUT; ++attempt)
 		{
-			loge("Model size too large");
-			logIssue();
-			return false;
+			logd("Trying %s packet size %u (attempt %u)", what, size, attempt + 1);
+			rs = probe(size);
+			if (rs == PROBE_OK)
+				break;
+
+			port.flush();
+			if (rs == PROBE_TIMEOUT && attempt + 1 < config::PROBE_ATTEMPTS)
+				port.getPacer().timedOut();
 		}
 
-		model.push_back(ch);
+		if (rs == PROBE_OK)
+			break;
+
+		if (rs == PROBE_TIMEOUT)
+			timedOut = true;
 	}
 
-	return true;
+	port.setQuiet(false);
+	port.getPacer() = pacer;
+	port.getPacer().received();
+
+	logi("Using %s packet size %u", what, size);
+
+	// larger sizes might have failed only because radio was slow to
+	// respond, so size is remembered only if radio rejected them
+	if (timedOut)
+		logd("Not caching %s packet size, as radio didn't respond to larger ones", what);
+	else
+	{
+		CLinkCache cache;
+		cache.set(packetSizeKey(model, write), size);
+		cache.save();
+	}
+
+	return size;
 }
 
-bool protocol::read(CPort &port, uint8_t *data, uint16_t offset, uint8_t size)
+uint8_t protocol::maxPacketSize(CPort &port, const std::string &model, uint8_t max)
 {
-	std::vector<uint8_t> req;
+	return probePacketSize(port, model, max, false, [&port](uint8_t size)
+	{
+		return probeRead(port, size);
+	});
+}
 
-	req.push_back('R');
-	req.push_back(offset >> 8);
-	req.push_back(offset & 0xff);
-	req.push_back(size);
+uint8_t protocol::maxWritePacketSize(CPort &port, const std::string &model, uint8_t max, uint16_t offset)
+{
+	return probePacketSize(port, model, max, true, [&port, offset](uint8_t size)
+	{
+		return probeWrite(port, size, offset);
+	});
+}
 
-	if (!exchange(port, req))
-		return false;
+static std::string pacingKey(CPort &port, const std::string &model)
+{
+	return std::string("gap:") + util::toPrintable(model) + ":" + port.getPath();
+}
+
+void protocol::loadPacing(CPort &port, const std::string &model, unsigned defaultGap)
+{
+	CLinkCache cache;
+	unsigned gap;
+	port.getPacer().setGap(cache.get(pacingKey(port, model), gap) ? gap : defaultGap);
+}
+
+// turnaround is stored separately for both latency modes, so they can be
+// compared
+static std::string turnaroundKey(CPort &port, bool lowLatency)
+{
+	return std::string(lowLatency ? "rtt-lowlat:" : "rtt:") + port.getPath();
+}
+
+void protocol::storePacing(CPort &port, const std::string &model)
+{
+	const CPacer &pacer(port.getPacer());
+	logi("Radio turnaround: %u us, inter-frame gap: %u us", pacer.getTurnaround(), pacer.getGap());
+
+	CLinkCache cache;
+	const bool lowLatency(port.isLowLatency());
+	unsigned other;
+	if (cache.get(turnaroundKey(port, !lowLatency), other))
+		logi("Turnaround %s low latency mode was: %u us", lowLatency ? "without" : "in", other);
+
+	cache.set(pacingKey(port, model), pacer.getGap());
+	cache.set(turnaroundKey(port, lowLatency), pacer.getTurnaround());
+	cache.save();
+}
 
-	std::vector<uint8_t> rsp;
-	rsp.resize(size + 6);
-	if (!port.read(&rsp[0], rsp.size()))
+template<size_t N> static bool readFrames(CPort &port, const CFrame<N> &frame, uint8_t *data, uint16_t offset, unsigned count, bool &reordered, unsigned &completed)
+{
+	const uint8_t size(frame.getSize());
+
+	// cable is half-duplex (radio would see its own response echoed
+	// otherwise), so all requests are sent together, before the radio
+	// starts responding, and not while previous response is arriving;
+	// count must be limited by protocol::maxReadBurst() for that
+	TBurstBuf req;
+	size_t reqSize(0);
+	// count is never 0 (do-while also tells the compiler that req
+	// gets initialized)
+	unsigned n(0);
+	do
+		reqSize += frame.encodeRead(&req[reqSize], offset + n * size);
+	while (++n < count);
+
+	reordered = false;
+	completed = 0;
+	if (!exchange(port, &req[0], reqSize))
 		return false;
 
-	if (rsp[0] != 'W' || rsp[1] != req[1] || rsp[2] != req[2] || rsp[3] != req[3] || rsp[rsp.size() - 1] != 0x06)
+	uint32_t done(0);
+	for (unsigned i(0); i < count; ++i)
 	{
-		loge("Invalid response from radio to read packet");
-		logIssue();
-		return false;
+		// turnaround is measured only for the first response, the
+		// rest follows immediately
+		const uint8_t *rsp(i == 0 ? readResponse(port, frame.getFrameSize()) : receive(port, frame.getFrameSize()));
+		if (!rsp)
+			return false;
+
+		if (!frame.isResponse(rsp))
+		{
+			loge("Invalid response from radio to read packet");
+			logIssue();
+			return false;
+		}
+
+		// responses are matched by offset
+		const uint16_t rspOffset(CFrame<N>::getOffset(rsp));
+		const unsigned idx((uint16_t) (rspOffset - offset) / size);
+		if (rspOffset < offset || (rspOffset - offset) % size || idx >= count || (done & (1U << idx)))
+		{
+			loge("Unexpected offset 0x%04x in response to read packet", rspOffset);
+			return false;
+		}
+
+		if (idx != i)
+		{
+			logd("Response for offset 0x%04x out of order", rspOffset);
+			reordered = true;
+		}
+
+		if (!frame.checksumValid(rsp))
+		{
+			loge("Checksum error in read packet");
+			logIssue();
+			return false;
+		}
+
+		memcpy(data + idx * size, CFrame<N>::getData(rsp), size);
+		done |= 1U << idx;
+
+		while (done & (1U << completed))
+			++completed;
 	}
 
-	uint8_t checksum(0);
-	for (size_t i(1); i < rsp.size() - 2; ++i)
-		checksum += rsp[i];
+	return true;
+}
 
-	if (rsp[rsp.size() - 2] != checksum)
-	{
-		loge("Checksum error in read packet");
-		logIssue();
+template<size_t N> static bool writeFrames(CPort &port, const CFrame<N> &frame, const uint8_t *data, uint16_t offset, unsigned count, unsigned &committed)
+{
+	const uint8_t size(frame.getSize());
+
+	// frames are sent together, like in readFrames(), but acknowledgement
+	// of the first one may come while the rest is still being sent; with
+	// cable echo, it would arrive amid the echo, so bursts are allowed
+	// only without it (see protocol::maxWriteBurst())
+	TBurstBuf req;
+	size_t reqSize(0);
+	unsigned n(0);
+	do
+		reqSize += frame.encodeWrite(&req[reqSize], offset + n * size, data + n * size);
+	while (++n < count);
+
+	committed = 0;
+	if (!exchange(port, &req[0], reqSize))
 		return false;
+
+	for (unsigned i(0); i < count; ++i)
+	{
+		const uint8_t *ack(i == 0 ? readResponse(port, 1) : receive(port, 1));
+		if (!ack)
+			return false;
+
+		if (*ack != CFrame<N>::ACK)
+		{
+			loge("Radio did not acknowledge write packet at offset 0x%04x correctly", offset + i * size);
+			return false;
+		}
+
+		++committed;
 	}
 
-	memcpy(data, &rsp[4], size);
 	return true;
 }
 
-bool protocol::write(CPort &port, const uint8_t *data, uint16_t offset, uint8_t size)
+unsigned protocol::maxReadBurst(CPort &port)
+{
+	// unknown (or negligible) turnaround doesn't leave time for more
+	// than one request
+	const unsigned turnaround(port.getPacer().getTurnaround());
+	if (!turnaround)
+		return 1;
+
+	// (count - 1) requests are sent after the first one, while radio is
+	// already processing it
+	const unsigned count((turnaround - 1) / CPort::transferTime(CFrame<0>::HDR_SIZE) + 1);
+	return count < config::MAX_WINDOW ? count : config::MAX_WINDOW;
+}
+
+unsigned protocol::maxWriteBurst(CPort &port)
 {
-	xassert(size != 0, "Refusing to write empty buffer");
+	return port.hasEcho() ? 1 : config::MAX_WINDOW;
+}
+
+bool protocol::read(CPort &port, uint8_t *data, uint16_t offset, uint8_t size)
+{
+	bool reordered;
+	unsigned completed;
+	return readBurst(port, data, offset, size, 1, reordered, completed);
+}
+
+bool protocol::readBurst(CPort &port, uint8_t *data, uint16_t offset, uint8_t size, unsigned count, bool &reordered, unsigned &completed)
+{
+	xassert(count != 0 && count <= config::MAX_WINDOW, "Invalid read burst length %u", count);
+	xassert(size != 0 && size <= config::MAX_PACKET_SIZE, "Invalid packet size %u", size);
+
+	// common sizes get their own, unrolled, codec
+	switch (size)
+	{
+		case 0x10:
+			return readFrames(port, CFrame<0x10>(), data, offset, count, reordered, completed);
+
+		case 0x20:
+			return readFrames(port, CFrame<0x20>(), data, offset, count, reordered, completed);
+
+		case 0x40:
+			return readFrames(port, CFrame<0x40>(), data, offset, count, reordered, completed);
+
+		case 0x80:
+			return readFrames(port, CFrame<0x80>(), data, offset, count, reordered, completed);
 
-	std::vector<uint8_t> req;
-	req.resize(size + 6);
+		default:
+			return readFrames(port, CFrame<0>(size), data, offset, count, reordered, completed);
+	}
+}
 
-	req[0] = 'W';
-	req[1] = offset >> 8;
-	req[2] = offset & 0xff;
-	req[3] = size;
-	req[size + 4] = req[1] + req[2] + req[3];
-	req[size + 5] = 0x06;
+bool protocol::write(CPort &port, const uint8_t *data, uint16_t offset, uint8_t size)
+{
+	unsigned committed;
+	return writeBurst(port, data, offset, size, 1, committed);
+}
+
+bool protocol::writeBurst(CPort &port, const uint8_t *data, uint16_t offset, uint8_t size, unsigned count, unsigned &committed)
+{
+	xassert(count != 0 && count <= config::MAX_WINDOW, "Invalid write burst length %u", count);
+	xassert(count == 1 || !port.hasEcho(), "Write burst with cable echo");
+	xassert(size != 0 && size <= config::MAX_PACKET_SIZE, "Invalid packet size %u", size);
 
-	for (size_t i(0); i < size; ++i)
+	switch (size)
 	{
-		req[i + 4] = data[i];
-		req[size + 4] += data[i];
+		case 0x10:
+			return writeFrames(port, CFrame<0x10>(), data, offset, count, committed);
+
+		case 0x20:
+			return writeFrames(port, CFrame<0x20>(), data, offset, count, committed);
+
+		case 0x40:
+			return writeFrames(port, CFrame<0x40>(), data, offset, count, committed);
+
+		case 0x80:
+			return writeFrames(port, CFrame<0x80>(), data, offset, count, committed);
+
+		default:
+			return writeFrames(port, CFrame<0>(size), data, offset, count, committed);
 	}
+}
 
-	if (!exchange(port, req))
+bool protocol::end(CPort &port)
+{
+	if (!exchange(port, "END"))
 		return false;
 
 	uint8_t ack;
-	if (!port.read(&ack, sizeof(ack)))
+	if (!port.read(&ack, sizeof(ack), port.responseBudget(sizeof(ack))))
 		return false;
 
 	if (ack != 0x06)
 	{
-		loge("Radio did not acknowledge write packet correctly");
+		loge("Radio did not acknowledge termination correctly");
 		return false;
 	}
 
 	return true;
 }
 
-bool protocol::end(CPort &port)
+bool protocol::resync(CPort &port, const std::string &model, bool handshake)
 {
-	if (!exchange(port, "END"))
-		return false;
+	port.flush();
+	if (!handshake)
+		return true;
 
-	uint8_t ack;
-	if (!port.read(&ack, sizeof(ack)))
+	// if radio left programming mode, timeouts weren't caused by
+	// pacing; if it didn't, session is lost anyway
+	port.getPacer().rollback();
+
+	SRadioId id;
+	if (!protocol::handshake(port, id))
+	{
+		loge("Cannot re-enter programming mode");
 		return false;
+	}
 
-	if (ack != 0x06)
+	if (id.raw != model)
 	{
-		loge("Radio did not acknowledge termination correctly");
+		loge("Radio ID changed during resynchronization: %s", util::toPrintable(id.raw).c_str());
 		return false;
 	}
 
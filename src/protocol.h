@@ -11,8 +11,73 @@
 
 namespace protocol
 {
-	bool handshake(CPort &port, std::string &model);
+	// radio ID returned in handshake; known radios send
+	// I<name><01>V<version><00><00>, see doc/comm-protocol.txt
+	struct SRadioId
+	{
+		// whole ID, as stored in .omi files
+		std::string raw;
+
+		// empty if ID has unknown format; name has trailing NULs
+		// removed
+		std::string name;
+		std::string version;
+
+		// returns false if ID has unknown format (raw is set anyway)
+		bool parse(const std::string &s);
+	};
+
+	bool handshake(CPort &port, SRadioId &id);
+
+	// largest packet size (up to max) accepted by the radio in read
+	// requests; remembered per model in link cache if radio rejected
+	// larger sizes, so the radio is probed only once
+	uint8_t maxPacketSize(CPort &port, const std::string &model, uint8_t max);
+
+	// same for write requests, which radio may limit separately; probed
+	// by writing back max bytes read from offset, which must be
+	// writable and covered by whatever protects the data being written
+	uint8_t maxWritePacketSize(CPort &port, const std::string &model, uint8_t max, uint16_t offset);
+
+	// returns false if there's no valid size cached for model
+	bool cachedPacketSize(const std::string &model, uint8_t max, bool write, uint8_t &size);
+
+	// inter-frame gap learned by port pacer; remembered per model
+	// and port in link cache, defaultGap is used if it's not there
+	void loadPacing(CPort &port, const std::string &model, unsigned defaultGap);
+	void storePacing(CPort &port, const std::string &model);
+
 	bool read(CPort &port, uint8_t *data, uint16_t offset, uint8_t size);
+
+	// reads count consecutive packets with all requests in flight at
+	// once; reordered is set if radio responded out of order (data is
+	// still valid then, but it's safer not to use bursts anymore).
+	// completed is set to number of leading packets received before
+	// first error (or to count if there was no error)
+	bool readBurst(CPort &port, uint8_t *data, uint16_t offset, uint8_t size, unsigned count, bool &reordered, unsigned &completed);
+
+	// largest number of read requests which can be sent in one burst:
+	// all of them must be sent before radio starts responding to the
+	// first one, so (count - 1) request transfer times must be shorter
+	// than measured radio turnaround
+	unsigned maxReadBurst(CPort &port);
 	bool write(CPort &port, const uint8_t *data, uint16_t offset, uint8_t size);
+
+	// writes count consecutive packets with all frames in flight at
+	// once; committed is set to number of packets acknowledged before
+	// first error (or to count if there was no error). Packets after
+	// these might have been written or not
+	bool writeBurst(CPort &port, const uint8_t *data, uint16_t offset, uint8_t size, unsigned count, unsigned &committed);
+
+	// largest number of write frames which can be sent in one burst;
+	// acknowledgements would collide with cable echo, so with echo it's
+	// one
+	unsigned maxWriteBurst(CPort &port);
 	bool end(CPort &port);
+
+	// brings the link back to a known state after framing errors:
+	// discards pending input and waits for a quiet line; with
+	// handshake, also re-enters programming mode (in case the radio
+	// left it) and checks if it's still the same radio
+	bool resync(CPort &port, const std::string &model, bool handshake);
 }
@@ -39,21 +39,24 @@ bool CRawReader::operator()(void *p, size_t sz, size_t *outsz)
 	return rs == sz;
 }
 
-CRawWriter::CRawWriter(const std::string &path): m_path(path)
+CRawWriter::CRawWriter(const std::string &path, bool inPlace): m_path(path), m_tmpPath(inPlace ? path : path + ".tmp")
 {
-	logd("Opening file %s.tmp for writing", m_path.c_str());
-	m_fp = fopen((m_path + ".tmp").c_str(), "wb");
+	logd("Opening file %s for writing", m_tmpPath.c_str());
+	m_fp = fopen(m_tmpPath.c_str(), "wb");
 	if (!m_fp)
-		loge("Cannot open file %s.tmp for writing: %m", m_path.c_str());
+		loge("Cannot open file %s for writing: %m", m_tmpPath.c_str());
 }
 
 CRawWriter::~CRawWriter()
 {
-	if (m_fp)
+	if (!m_fp)
+		return;
+
+	fclose(m_fp);
+	if (m_tmpPath != m_path)
 	{
-		logd("Writer got out of scope, removing file %s.tmp", m_path.c_str());
-		fclose(m_fp);
-		unlink((m_path + ".tmp").c_str());
+		logd("Writer got out of scope, removing file %s", m_tmpPath.c_str());
+		unlink(m_tmpPath.c_str());
 	}
 }
 
@@ -68,18 +71,31 @@ bool CRawWriter::operator()(const void *p, size_t sz)
 	return fwrite(p, sz, 1, m_fp) == 1;
 }
 
+bool CRawWriter::flush()
+{
+	xassert(isOpen(), "Attempted flush of closed file");
+	return fflush(m_fp) == 0;
+}
+
 bool CRawWriter::close()
 {
-	logd("Closing file %s.tmp and renaming to %s", m_path.c_str(), m_path.c_str());
 	xassert(isOpen(), "Attempted closing of closed file");
-	fclose(m_fp);
+	const bool rs(fclose(m_fp) == 0);
 	m_fp = NULL;
+
+	if (m_tmpPath == m_path)
+	{
+		logd("Closed file %s", m_path.c_str());
+		return rs;
+	}
+
+	logd("Closed file %s and renaming to %s", m_tmpPath.c_str(), m_path.c_str());
 	unlink(m_path.c_str());
-	if (rename((m_path + ".tmp").c_str(), m_path.c_str()) != 0)
+	if (rename(m_tmpPath.c_str(), m_path.c_str()) != 0)
 	{
-		logd("Cannot rename file %s.tmp: %m", m_path.c_str());
+		logd("Cannot rename file %s: %m", m_tmpPath.c_str());
 		return false;
 	}
 
-	return true;
+	return rs;
 }
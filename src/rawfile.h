@@ -29,14 +29,19 @@ private:
 class CRawWriter
 {
 public:
-	CRawWriter(const std::string &path);
+	// data is written to a temporary file, renamed on close, unless
+	// inPlace is set; then it's written directly, so it can be read
+	// while it's being written, and is kept if not closed
+	CRawWriter(const std::string &path, bool inPlace = false);
 	~CRawWriter();
 
 	bool isOpen() const;
 	bool operator()(const void *p, size_t sz);
+	bool flush();
 	bool close();
 
 private:
 	const std::string m_path;
+	const std::string m_tmpPath;
 	FILE *m_fp;
 };
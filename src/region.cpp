@@ -0,0 +1,175 @@
+/**
+ * \brief	Memory regions
+ * \author	Circuit Chaos
+ * \date	2020-04-09
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include "region.h"
+#include "util.h"
+#include "throw.h"
+
+static unsigned end(const region::SRegion &r)
+{
+	return r.offset + r.size;
+}
+
+// appends offset-end range, split into parts of at most MAX_SIZE
+static void append(region::TList &list, unsigned offset, unsigned end)
+{
+	xassert(end <= region::ADDR_SPACE, "Region 0x%04x-0x%04x out of address space", offset, end);
+	for (; offset < end; offset += region::MAX_SIZE)
+		list.push_back(region::SRegion { uint16_t(offset), uint16_t(std::min(end - offset, region::MAX_SIZE)) });
+}
+
+void region::normalize(TList &list)
+{
+	std::sort(list.begin(), list.end(), [](const SRegion &a, const SRegion &b)
+	{
+		return a.offset < b.offset;
+	});
+
+	TList out;
+	unsigned ofs(0);
+	unsigned e(0);
+	for (const auto &r: list)
+	{
+		if (!r.size)
+			continue;
+
+		if (e && r.offset <= e)
+		{
+			e = std::max(e, end(r));
+			continue;
+		}
+
+		append(out, ofs, e);
+		ofs = r.offset;
+		e = end(r);
+	}
+
+	append(out, ofs, e);
+	list.swap(out);
+}
+
+void region::align(TList &list, unsigned alignment)
+{
+	TList out;
+	for (const auto &r: list)
+		append(out, r.offset & ~(alignment - 1), (end(r) + alignment - 1) & ~(alignment - 1));
+
+	list.swap(out);
+	normalize(list);
+}
+
+region::TList region::intersect(const TList &a, const TList &b)
+{
+	TList out;
+	for (const auto &ra: a)
+	{
+		for (const auto &rb: b)
+		{
+			const unsigned ofs(std::max(ra.offset, rb.offset));
+			const unsigned e(std::min(end(ra), end(rb)));
+			if (ofs < e)
+				out.push_back(SRegion { uint16_t(ofs), uint16_t(e - ofs) });
+		}
+	}
+
+	normalize(out);
+	return out;
+}
+
+region::TList region::subtract(const TList &a, const TList &b)
+{
+	TList out;
+	for (const auto &ra: a)
+	{
+		unsigned ofs(ra.offset);
+		for (const auto &rb: b)
+		{
+			if (end(rb) <= ofs || rb.offset >= end(ra))
+				continue;
+
+			if (rb.offset > ofs)
+				out.push_back(SRegion { uint16_t(ofs), uint16_t(rb.offset - ofs) });
+
+			ofs = end(rb);
+		}
+
+		if (ofs < end(ra))
+			out.push_back(SRegion { uint16_t(ofs), uint16_t(end(ra) - ofs) });
+	}
+
+	normalize(out);
+	return out;
+}
+
+bool region::contains(const TList &list, unsigned offset, unsigned size)
+{
+	// range may span adjacent parts of a large region
+	const unsigned e(offset + size);
+	for (const auto &r: list)
+	{
+		if (offset >= r.offset && offset < end(r))
+			offset = end(r);
+
+		if (offset >= e)
+			return true;
+	}
+
+	return false;
+}
+
+unsigned region::totalSize(const TList &list)
+{
+	unsigned size(0);
+	for (const auto &r: list)
+		size += r.size;
+
+	return size;
+}
+
+bool region::parse(const std::string &s, TList &list)
+{
+	list.clear();
+	for (const auto &tok: util::tokenize(s, ','))
+	{
+		const size_t dash(tok.find('-'));
+		if (dash == std::string::npos)
+			return false;
+
+		const std::string first(tok.substr(0, dash));
+		const std::string last(tok.substr(dash + 1));
+		char *firstEnd;
+		char *lastEnd;
+		const unsigned long ofs(strtoul(first.c_str(), &firstEnd, 16));
+		const unsigned long e(strtoul(last.c_str(), &lastEnd, 16));
+
+		if (first.empty() || last.empty() || *firstEnd || *lastEnd)
+			return false;
+
+		if (ofs >= e || e > ADDR_SPACE)
+			return false;
+
+		append(list, ofs, e);
+	}
+
+	normalize(list);
+	return !list.empty();
+}
+
+std::string region::toString(const TList &list)
+{
+	std::string s;
+	for (const auto &r: list)
+	{
+		if (!s.empty())
+			s += ",";
+
+		s += util::format("0x%04x-0x%04x", r.offset, end(r));
+	}
+
+	return s;
+}
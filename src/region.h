@@ -0,0 +1,54 @@
+/**
+ * \brief	Memory regions
+ * \author	Circuit Chaos
+ * \date	2020-04-09
+ *
+ * Lists of address ranges in radio memory: what a model allows to read
+ * and write, what the user asked for, and what is present in a sparse
+ * .omi file.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <inttypes.h>
+
+namespace region
+{
+	struct SRegion
+	{
+		uint16_t offset;
+		uint16_t size;
+	};
+
+	typedef std::vector<SRegion> TList;
+
+	// offsets are 16-bit
+	static const unsigned ADDR_SPACE	= 0x10000;
+
+	// size must fit in 16 bits, so larger regions are kept as adjacent
+	// parts of at most this size
+	static const unsigned MAX_SIZE		= 0x8000;
+
+	// sorts list, merges overlapping and adjacent regions (up to
+	// MAX_SIZE) and drops empty ones; other functions expect
+	// normalized lists
+	void normalize(TList &list);
+
+	// extends regions to be aligned to given size (power of two)
+	void align(TList &list, unsigned alignment);
+
+	TList intersect(const TList &a, const TList &b);
+
+	// parts of a which are not in b
+	TList subtract(const TList &a, const TList &b);
+
+	bool contains(const TList &list, unsigned offset, unsigned size);
+	unsigned totalSize(const TList &list);
+
+	// start-end pairs, hexadecimal, end exclusive (up to ADDR_SPACE),
+	// separated by commas
+	bool parse(const std::string &s, TList &list);
+	std::string toString(const TList &list);
+}
@@ -0,0 +1,109 @@
+/**
+ * \brief	Programming session
+ * \author	Circuit Chaos
+ * \date	2020-04-07
+ */
+
+#include "session.h"
+#include "protocol.h"
+#include "config.h"
+#include "throw.h"
+#include "log.h"
+#include "util.h"
+
+CSession::CSession(const std::string &port, unsigned window, bool lowLatency):
+	m_port(port, config::PORT_TIMEOUT),
+	m_caps(NULL),
+	m_open(false)
+{
+	if (!m_port.isOpen())
+	{
+		loge("Error opening communication port");
+		return;
+	}
+
+	if (lowLatency && !m_port.setLowLatency())
+		logn("Low latency mode not available, continuing without it");
+
+	if (!protocol::handshake(m_port, m_id))
+	{
+		loge("Protocol error during handshake");
+		return;
+	}
+
+	logn("Radio ID string: %s", util::toPrintable(m_id.raw).c_str());
+
+	m_caps = &models::find(m_id.raw);
+	m_open = true;
+	m_xfer.reset(new CTransfer(m_port, m_id.raw, *m_caps, window));
+}
+
+CSession::~CSession()
+{
+	if (!m_open)
+		return;
+
+	if (!protocol::end(m_port))
+		loge("Additional error while trying to terminate session");
+}
+
+bool CSession::isOpen() const
+{
+	return m_open;
+}
+
+const std::string &CSession::getModel() const
+{
+	return m_id.raw;
+}
+
+const protocol::SRadioId &CSession::getId() const
+{
+	return m_id;
+}
+
+const models::SModel &CSession::getCaps() const
+{
+	xassert(m_caps, "Session not open");
+	return *m_caps;
+}
+
+void CSession::setProgress(const CTransfer::TProgress &progress)
+{
+	xassert(m_open, "Session not open");
+	m_xfer->setProgress(progress);
+}
+
+void CSession::setCommit(const CTransfer::TCommit &commit)
+{
+	xassert(m_open, "Session not open");
+	m_xfer->setCommit(commit);
+}
+
+bool CSession::read(uint8_t *data, uint16_t offset, uint16_t size)
+{
+	xassert(m_open, "Session not open");
+	return m_xfer->readRange(data, offset, size);
+}
+
+bool CSession::write(const uint8_t *data, uint16_t offset, uint16_t size)
+{
+	xassert(m_open, "Session not open");
+	return m_xfer->writeRange(data, offset, size);
+}
+
+bool CSession::close()
+{
+	xassert(m_open, "Session not open");
+
+	m_xfer->finish();
+	m_open = false;
+
+	if (!protocol::end(m_port))
+	{
+		loge("Protocol error during termination");
+		return false;
+	}
+
+	return true;
+}
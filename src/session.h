@@ -0,0 +1,53 @@
+/**
+ * \brief	Programming session
+ * \author	Circuit Chaos
+ * \date	2020-04-07
+ *
+ * Opens the port and puts the radio into programming mode; any number
+ * of reads and writes can be done then. Session is always terminated
+ * with END, even if the object goes out of scope because of an error
+ * or an exception.
+ */
+
+#pragma once
+
+#include <string>
+#include <memory>
+#include <inttypes.h>
+#include "port.h"
+#include "transfer.h"
+#include "protocol.h"
+#include "models.h"
+
+class CSession
+{
+public:
+	CSession(const std::string &port, unsigned window, bool lowLatency);
+	~CSession();
+
+	// false if port could not be opened or handshake failed
+	bool isOpen() const;
+	const std::string &getModel() const;
+	const protocol::SRadioId &getId() const;
+	const models::SModel &getCaps() const;
+
+	void setProgress(const CTransfer::TProgress &progress);
+	void setCommit(const CTransfer::TCommit &commit);
+
+	bool read(uint8_t *data, uint16_t offset, uint16_t size);
+	bool write(const uint8_t *data, uint16_t offset, uint16_t size);
+
+	// called after successful transfers; stores learned link
+	// parameters and terminates the session
+	bool close();
+
+private:
+	CSession(const CSession &);
+	CSession &operator=(const CSession &);
+
+	CPort m_port;
+	protocol::SRadioId m_id;
+	const models::SModel *m_caps;
+	std::unique_ptr<CTransfer> m_xfer;
+	bool m_open;
+};
@@ -50,7 +50,7 @@ bool CTextFile::write(const std::string &path, bool isText) const
 
 	for (auto &i: m_data)
 	{
-		const std::string s((isText ? toTextLine(i) : toCsvLine(i)) + '\n');
+		const std::string s(format(i, isText) + '\n');
 		if (!w(s.c_str(), s.size()))
 			return false;
 	}
@@ -61,6 +61,11 @@ bool CTextFile::write(const std::string &path, bool isText) const
 	return true;
 }
 
+std::string CTextFile::format(const TLine &line, bool isText)
+{
+	return isText ? toTextLine(line) : toCsvLine(line);
+}
+
 std::string CTextFile::toTextLine(const TLine &line)
 {
 	std::string s;
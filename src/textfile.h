@@ -18,6 +18,9 @@ public:
 	void add(const TLine &line);
 	bool write(const std::string &path, bool isText) const;
 
+	// line as written to file, without line separator
+	static std::string format(const TLine &line, bool isText);
+
 	bool read(const std::string &path, bool isText);
 	// no need to implement custom reading methods...
 	const std::vector<TLine> &get() const;
@@ -0,0 +1,252 @@
+/**
+ * \brief	Range transfers
+ * \author	Circuit Chaos
+ * \date	2020-04-05
+ */
+
+#include <algorithm>
+#include "transfer.h"
+#include "protocol.h"
+#include "log.h"
+#include "util.h"
+#include "config.h"
+
+CTransfer::CTransfer(CPort &port, const std::string &model, const models::SModel &caps, unsigned window):
+	m_port(port),
+	m_model(model),
+	m_caps(caps),
+	m_pkt(protocol::maxPacketSize(port, model, caps.maxPacketSize)),
+	m_writePkt(config::PACKET_SIZE),
+	m_writeProbed(false),
+	m_window(window),
+	m_packets(0),
+	m_bytes(0),
+	m_time(0),
+	m_resyncs(0),
+	m_resyncTime(0)
+{
+	protocol::loadPacing(port, model, caps.defaultGap);
+}
+
+void CTransfer::setProgress(const TProgress &progress)
+{
+	m_progress = progress;
+}
+
+void CTransfer::setCommit(const TCommit &commit)
+{
+	m_commit = commit;
+}
+
+bool CTransfer::readRange(uint8_t *data, uint16_t offset, uint16_t size)
+{
+	const uint64_t start(util::monotonicUs());
+	const unsigned end(offset + size);
+	unsigned retries(0);
+
+	for (unsigned ofs(offset); ofs < end;)
+	{
+		const uint8_t len(packetLength(m_pkt, end - ofs));
+		const unsigned count(burstLength(end - ofs, len, protocol::maxReadBurst(m_port)));
+		uint8_t *p(data + ofs - offset);
+
+		if (m_progress)
+			m_progress(ofs, false);
+
+		if (count > 1)
+		{
+			bool reordered;
+			unsigned completed;
+			const bool ok(protocol::readBurst(m_port, p, ofs, len, count, reordered, completed));
+			if (!ok || reordered)
+			{
+				logn("Radio does not handle multiple requests in flight, falling back to one");
+				m_window = 1;
+			}
+
+			// packets received before the error are kept
+			transferred(ofs, len, completed, false);
+			ofs += completed * len;
+
+			if (!ok)
+			{
+				resync(false);
+				continue;
+			}
+
+			m_pkt.succeeded();
+			retries = 0;
+			continue;
+		}
+
+		if (!protocol::read(m_port, p, ofs, len))
+		{
+			if (recover(m_pkt, ofs, retries))
+				continue;
+
+			loge("Protocol error during read (offset 0x%04x)", ofs);
+			return false;
+		}
+
+		m_pkt.succeeded();
+		transferred(ofs, len, 1, false);
+		retries = 0;
+		ofs += len;
+	}
+
+	m_time += util::monotonicUs() - start;
+	return true;
+}
+
+bool CTransfer::writeRange(const uint8_t *data, uint16_t offset, uint16_t size)
+{
+	if (!m_writeProbed)
+	{
+		// probe rewrites data at the start of range, which is part of
+		// the write plan, so it's journaled and covered by undo file;
+		// ranges too small for the largest probe are written with the
+		// minimum size until one comes which isn't
+		uint8_t cached;
+		if (protocol::cachedPacketSize(m_model, m_caps.maxPacketSize, true, cached))
+		{
+			m_writePkt = CPacketSize(cached);
+			m_writeProbed = true;
+		}
+		else if (size >= m_caps.maxPacketSize)
+		{
+			m_writePkt = CPacketSize(protocol::maxWritePacketSize(m_port, m_model, m_caps.maxPacketSize, offset));
+			m_writeProbed = true;
+		}
+	}
+
+	const uint64_t start(util::monotonicUs());
+	const unsigned end(offset + size);
+	unsigned retries(0);
+
+	for (unsigned ofs(offset); ofs < end;)
+	{
+		const uint8_t len(packetLength(m_writePkt, end - ofs));
+		const unsigned count(burstLength(end - ofs, len, protocol::maxWriteBurst(m_port)));
+		const uint8_t *p(data + ofs - offset);
+
+		if (m_progress)
+			m_progress(ofs, true);
+
+		if (count > 1)
+		{
+			unsigned committed;
+			if (!protocol::writeBurst(m_port, p, ofs, len, count, committed))
+			{
+				// the rest of the burst is written again, whether it
+				// made it or not
+				if (committed)
+					logn("Offsets 0x%04x to 0x%04x acknowledged, writing the rest again", ofs, ofs + committed * len - 1);
+
+				logn("Radio does not handle multiple frames in flight, falling back to one");
+				m_window = 1;
+				resync(false);
+			}
+			else
+			{
+				m_writePkt.succeeded();
+				retries = 0;
+			}
+
+			transferred(ofs, len, committed, true);
+			ofs += committed * len;
+			continue;
+		}
+
+		if (!protocol::write(m_port, p, ofs, len))
+		{
+			if (recover(m_writePkt, ofs, retries))
+				continue;
+
+			loge("Protocol error during write (offset 0x%04x)", ofs);
+			return false;
+		}
+
+		m_writePkt.succeeded();
+		transferred(ofs, len, 1, true);
+		retries = 0;
+		ofs += len;
+	}
+
+	m_time += util::monotonicUs() - start;
+	return true;
+}
+
+void CTransfer::finish()
+{
+	protocol::storePacing(m_port, m_model);
+
+	if (m_resyncs)
+		logn("Recovered from %u error(s), %u ms spent resynchronizing", m_resyncs, (unsigned) (m_resyncTime / 1000));
+
+	if (m_time)
+		logi("Transferred %u bytes in %u packets in %u ms (%u bytes/s)", m_bytes, m_packets,
+			(unsigned) (m_time / 1000), (unsigned) ((uint64_t) m_bytes * 1000000 / m_time));
+}
+
+bool CTransfer::recover(CPacketSize &pkt, uint16_t offset, unsigned &retries)
+{
+	// both must be called, so no short-circuit evaluation
+	const bool backedOff(m_port.getPacer().backedOff());
+	const bool smaller(pkt.failed());
+
+	// retry budget is used only if nothing changed, so the next
+	// attempt has no better chance than this one
+	if (!backedOff && !smaller)
+	{
+		if (retries > config::MAX_RETRIES)
+			return false;
+
+		// last resort: radio might have left programming mode
+		if (++retries > config::MAX_RETRIES)
+		{
+			logn("Retries exhausted at offset 0x%04x, re-entering programming mode", offset);
+			return resync(true);
+		}
+
+		logn("Retrying offset 0x%04x (%u of %u)", offset, retries, config::MAX_RETRIES);
+	}
+
+	return resync(false);
+}
+
+bool CTransfer::resync(bool handshake)
+{
+	const uint64_t start(util::monotonicUs());
+	const bool rs(protocol::resync(m_port, m_model, handshake));
+	const uint64_t elapsed(util::monotonicUs() - start);
+
+	logd("Resynchronization took %u ms", (unsigned) (elapsed / 1000));
+	++m_resyncs;
+	m_resyncTime += elapsed;
+	return rs;
+}
+
+uint8_t CTransfer::packetLength(const CPacketSize &pkt, unsigned remaining)
+{
+	// remaining is a multiple of the minimum size, unless range isn't
+	// aligned to it
+	unsigned len(pkt.get());
+	while (len > remaining && len > config::PACKET_SIZE)
+		len /= 2;
+
+	return std::min(len, remaining);
+}
+
+unsigned CTransfer::burstLength(unsigned remaining, uint8_t len, unsigned limit) const
+{
+	return std::max(1u, std::min<unsigned>(std::min(m_window, limit), remaining / len));
+}
+
+void CTransfer::transferred(uint16_t offset, uint8_t len, unsigned count, bool written)
+{
+	m_packets += count;
+	m_bytes += len * count;
+
+	if (m_commit && count)
+		m_commit(offset, len * count, written);
+}
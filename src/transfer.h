@@ -0,0 +1,88 @@
+/**
+ * \brief	Range transfers
+ * \author	Circuit Chaos
+ * \date	2020-04-05
+ *
+ * Reads and writes arbitrary memory ranges, splitting them into
+ * packets and bursts. Packet size and window adapt to how the radio
+ * behaves; link parameters (packet size and pacing) learned during
+ * the session are stored by finish().
+ */
+
+#pragma once
+
+#include <string>
+#include <functional>
+#include <inttypes.h>
+#include "port.h"
+#include "pktsize.h"
+#include "models.h"
+
+class CTransfer
+{
+public:
+	// called before every packet or burst with its offset, and whether
+	// it's written or read
+	typedef std::function<void(uint16_t offset, bool write)> TProgress;
+
+	// called after packets have been received (read) or acknowledged
+	// by the radio (write)
+	typedef std::function<void(uint16_t offset, uint16_t size, bool written)> TCommit;
+
+	// read packet size is probed (or taken from link cache) here, so
+	// this must be constructed after handshake; write packet size is
+	// probed before the first write range large enough for it
+	CTransfer(CPort &port, const std::string &model, const models::SModel &caps, unsigned window);
+
+	void setProgress(const TProgress &progress);
+	void setCommit(const TCommit &commit);
+
+	// on error, session should be terminated
+	bool readRange(uint8_t *data, uint16_t offset, uint16_t size);
+	bool writeRange(const uint8_t *data, uint16_t offset, uint16_t size);
+
+	// stores learned pacing and logs statistics; called after
+	// successful transfer (packet sizes lowered because of errors are
+	// not stored, as errors might have been transient)
+	void finish();
+
+private:
+	CPort &m_port;
+	const std::string m_model;
+	const models::SModel &m_caps;
+	CPacketSize m_pkt;
+
+	// write frames are limited to the minimum size until probed
+	CPacketSize m_writePkt;
+	bool m_writeProbed;
+	unsigned m_window;
+	TProgress m_progress;
+	TCommit m_commit;
+
+	// statistics of successful transfers; time is in microseconds
+	unsigned m_packets;
+	unsigned m_bytes;
+	uint64_t m_time;
+	unsigned m_resyncs;
+	uint64_t m_resyncTime;
+
+	// called after failed single packet at offset, sent with packet
+	// size pkt (read or write one); returns true if it makes sense to
+	// try again. retries counts attempts for that packet, limited to
+	// config::MAX_RETRIES, after which the link is resynchronized with
+	// handshake as the last resort
+	bool recover(CPacketSize &pkt, uint16_t offset, unsigned &retries);
+
+	// see protocol::resync()
+	bool resync(bool handshake);
+
+	// returns size of next packet; at the end of a range, it's
+	// decreased to the largest of smaller sizes which fits, not to
+	// the remaining size, as radio accepts only probed sizes
+	static uint8_t packetLength(const CPacketSize &pkt, unsigned remaining);
+
+	// returns number of packets to send in next burst, up to the
+	// window and limit allowed by the link
+	unsigned burstLength(unsigned remaining, uint8_t len, unsigned limit) const;
+	void transferred(uint16_t offset, uint8_t len, unsigned count, bool written);
+};
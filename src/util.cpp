@@ -7,6 +7,7 @@
 #include <cstdarg>
 #include <cstdlib>
 #include <cstdio>
+#include <ctime>
 #include "util.h"
 #include "throw.h"
 
@@ -129,3 +130,23 @@ std::vector<std::string> util::tokenize(const std::string &src, char sep)
 	v.push_back(tmp);
 	return v;
 }
+
+uint64_t util::monotonicUs()
+{
+	struct timespec ts;
+	xassert(clock_gettime(CLOCK_MONOTONIC, &ts) == 0, "clock_gettime() failed");
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t util::hash(const void *data, size_t size)
+{
+	uint64_t h(0xcbf29ce484222325ULL);
+	const uint8_t *p((const uint8_t *) data);
+	while (size--)
+	{
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
@@ -23,4 +23,11 @@ namespace util
 	std::string toPrintable(const std::string &s);
 	std::string stripRight(const std::string &s);
 	std::vector<std::string> tokenize(const std::string &src, char sep);
+
+	// monotonic clock, in microseconds
+	uint64_t monotonicUs();
+
+	// 64-bit FNV-1a; for identifying data in journals, crc32() can't
+	// be used as it must stay compatible with existing .omi files
+	uint64_t hash(const void *data, size_t size);
 }